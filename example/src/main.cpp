@@ -32,7 +32,7 @@ using namespace msa::physics;
 #define MAX_ATTRACTION			10
 #define MIN_ATTRACTION			3
 
-#define SECTOR_COUNT			1		// currently there is a bug at sector borders, so setting this to 1
+#define SECTOR_COUNT			0		// 0: work out the sector size automatically from the largest particle
 
 class ofApp : public ofBaseApp {
 public:
@@ -52,6 +52,7 @@ public:
     ofImage				ballImage;
     World3D_ptr         world;
     Particle3D_ptr      mouseNode;
+    Attractor3D_ptr     mouseAttractor;     // pulls all particles towards the mouse node
 
     void initScene() {
         width = ofGetWidth();
@@ -84,6 +85,10 @@ public:
 
         // you can daisy chain methods
         mouseNode->makeFixed()->setMass(MIN_MASS)->moveTo(ofVec3f(0, 0, 0))->setRadius(NODE_MAX_RADIUS);
+
+        // one attractor acts on every particle, instead of an attraction from the mouse node to each one
+        mouseAttractor = world->makeAttractor(kAttractorPoint, mouseNode->getPosition(), 0);
+        if(!mouseAttract) mouseAttractor->turnOff();
     }
 
 
@@ -137,9 +142,6 @@ public:
 
         // you don't have to daisy chain all methods, you can break the chain whereever you want to
         p->enableCollision()->makeFree();
-
-        // add an attraction to the mouseNode
-        if(mouseAttract) world->makeAttraction(mouseNode, p, ofRandom(MIN_ATTRACTION, MAX_ATTRACTION));
     }
 
     //--------------------------------------------------------------
@@ -169,15 +171,8 @@ public:
     //--------------------------------------------------------------
     void toggleMouseAttract() {
         mouseAttract = !mouseAttract;
-        if(mouseAttract) {
-            // loop through all particles and add attraction to mouse
-            // (doesn't matter if we attach attraction from mouse-mouse cos it won't be added internally
-            for(int i=0; i<world->numberOfParticles(); i++) world->makeAttraction(mouseNode, world->getParticle(i), ofRandom(MIN_ATTRACTION, MAX_ATTRACTION));
-        } else {
-            // loop through all existing attractions and delete them
-            // (if we had other non mouse attractions, they would be deleted as well, but we don't, so it doesn't matter)
-            for(int i=0; i<world->numberOfAttractions(); i++) world->getAttraction(i)->kill();
-        }
+        if(mouseAttract) mouseAttractor->turnOn();
+        else mouseAttractor->turnOff();
     }
 
     //--------------------------------------------------------------
@@ -219,6 +214,9 @@ public:
         width = ofGetWidth();
         height = ofGetHeight();
 
+        // the attractor follows the mouse node, and pulls harder the heavier it is
+        mouseAttractor->setPosition(mouseNode->getPosition())->setStrength((MIN_ATTRACTION + MAX_ATTRACTION) * 0.5f * mouseNode->getMass());
+
         // update the world!
         world->update();
     }
@@ -15,9 +15,20 @@
 #include "MSAPhysicsParticle.h"
 #include "MSAPhysicsConstraint.h"
 #include "MSAPhysicsSpring.h"
+#include "MSAPhysicsSpringBatch.h"
+
 #include "MSAPhysicsAttraction.h"
+#include "MSAPhysicsConstraintList.h"
+#include "MSAPhysicsAttractor.h"
+#include "MSAPhysicsEmitter.h"
+
 
 #include "MSAPhysicsParams.h"
+#include "MSAPhysicsWorkerPool.h"
+#include "MSAPhysicsBarnesHut.h"
+#include "MSAPhysicsQueryGrid.h"
+
+
 //#include "MSAPhysicsCallbacks.h"
 
 #include "MSAPhysicsSector.h"
@@ -10,12 +10,18 @@ typedef ParticleT<Vec2f>                    Particle2D;
 typedef SpringT<Vec2f>                      Spring2D;
 typedef AttractionT<Vec2f>                  Attraction2D;
 typedef ConstraintT<Vec2f>                  Constraint2D;
+typedef AttractorT<Vec2f>                   Attractor2D;
+typedef EmitterT<Vec2f>                     Emitter2D;
+typedef RayHitT<Vec2f>                      RayHit2D;
 
 typedef shared_ptr< WorldT<Vec2f> >			World2D_ptr;
 typedef shared_ptr< ParticleT<Vec2f> >      Particle2D_ptr;
 typedef shared_ptr< SpringT<Vec2f> >		Spring2D_ptr;
 typedef shared_ptr< AttractionT<Vec2f> >	Attraction2D_ptr;
 typedef shared_ptr< ConstraintT<Vec2f> >    Constraint2D_ptr;
+typedef shared_ptr< AttractorT<Vec2f> >     Attractor2D_ptr;
+typedef shared_ptr< EmitterT<Vec2f> >       Emitter2D_ptr;
+
 //typedef ParticleUpdater_ptr<Vec2f>	ParticleUpdater2D_ptr;
 
 }
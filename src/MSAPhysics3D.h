@@ -10,12 +10,18 @@ typedef ParticleT<Vec3f>                    Particle3D;
 typedef SpringT<Vec3f>                      Spring3D;
 typedef AttractionT<Vec3f>                  Attraction3D;
 typedef ConstraintT<Vec3f>                  Constraint3D;
+typedef AttractorT<Vec3f>                   Attractor3D;
+typedef EmitterT<Vec3f>                     Emitter3D;
+typedef RayHitT<Vec3f>                      RayHit3D;
 
 typedef shared_ptr< WorldT<Vec3f> >			World3D_ptr;
 typedef shared_ptr< ParticleT<Vec3f> >      Particle3D_ptr;
 typedef shared_ptr< SpringT<Vec3f> >		Spring3D_ptr;
 typedef shared_ptr< AttractionT<Vec3f> >	Attraction3D_ptr;
 typedef shared_ptr< ConstraintT<Vec3f> >    Constraint3D_ptr;
+typedef shared_ptr< AttractorT<Vec3f> >     Attractor3D_ptr;
+typedef shared_ptr< EmitterT<Vec3f> >       Emitter3D_ptr;
+
 //typedef ParticleUpdater_ptr<Vec3f>	ParticleUpdater3D_ptr;
 
 }
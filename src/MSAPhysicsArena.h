@@ -0,0 +1,146 @@
+#pragma once
+
+#include "MSACore.h"
+
+#include <mutex>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+
+namespace msa {
+namespace physics {
+
+// fixed size blocks carved out of big slabs, with a free list for each block size
+// the world makes its particles and constraints in one of these (through ArenaAllocator and allocate_shared), so they are packed together,
+// and making one is a pop off a free list rather than a malloc
+// objects made with allocate_shared keep a copy of their allocator, and with it the arena, so it lives until the last of them has gone. then all slabs are freed at once
+class Arena {
+public:
+    typedef shared_ptr< Arena >         Arena_ptr;
+
+    static Arena_ptr create()                           { return Arena_ptr(new Arena()); }
+
+    ~Arena();
+
+    void*               allocate(size_t size);
+    void                deallocate(void *p, size_t size);
+
+    // bytes taken from the system, and held by live objects
+    size_t              getCapacity() const             { return _capacity; }
+    size_t              getUsed() const                 { return _used; }
+
+protected:
+    enum { kAlignment = 16, kMinSlabBlocks = 64, kMaxSlabBlocks = 4096 };
+
+    struct FreeBlock {
+        FreeBlock       *next;
+    };
+
+    struct Pool {
+        size_t          blockSize;
+        FreeBlock       *free;
+        size_t          numBlocks;      // in all slabs
+    };
+
+    vector< Pool >      _pools;         // one per block size, there are only a handful
+    vector< void* >     _slabs;
+    size_t              _capacity;
+    size_t              _used;
+    mutex               _mutex;         // objects might be let go of on any thread
+
+    Arena() : _capacity(0), _used(0) {}
+
+    Pool&               getPool(size_t blockSize);
+    void                addSlab(Pool& pool);
+};
+
+
+// a standard allocator for type U, which takes its memory from an arena
+// it also constructs U, so classes with protected constructors can make it a friend, and still be made with allocate_shared
+template <typename U>
+class ArenaAllocator {
+public:
+    typedef U           value_type;
+
+    ArenaAllocator(const Arena::Arena_ptr& arena) : _arena(arena) {}
+    template <typename V>
+    ArenaAllocator(const ArenaAllocator< V >& a) : _arena(a._arena) {}
+
+    U*                  allocate(size_t n)              { return static_cast< U* >(_arena->allocate(n * sizeof(U))); }
+    void                deallocate(U *p, size_t n)      { _arena->deallocate(p, n * sizeof(U)); }
+
+    template <typename V, typename... Args>
+    void                construct(V *p, Args&&... args) { ::new((void*)p) V(std::forward< Args >(args)...); }
+    template <typename V>
+    void                destroy(V *p)                   { p->~V(); }
+
+    template <typename V>
+    bool                operator==(const ArenaAllocator< V >& a) const  { return _arena == a._arena; }
+    template <typename V>
+    bool                operator!=(const ArenaAllocator< V >& a) const  { return _arena != a._arena; }
+
+protected:
+    template <typename> friend class ArenaAllocator;
+
+    Arena::Arena_ptr    _arena;
+};
+
+
+//--------------------------------------------------------------
+inline Arena::~Arena() {
+    for(auto&& s : _slabs) free(s);
+}
+
+//--------------------------------------------------------------
+inline void* Arena::allocate(size_t size) {
+    lock_guard< mutex > lock(_mutex);
+    Pool &pool = getPool(size);
+    if(!pool.free) addSlab(pool);
+    FreeBlock *b = pool.free;
+    pool.free = b->next;
+    _used += pool.blockSize;
+    return b;
+}
+
+//--------------------------------------------------------------
+inline void Arena::deallocate(void *p, size_t size) {
+    if(!p) return;
+    lock_guard< mutex > lock(_mutex);
+    Pool &pool = getPool(size);
+    FreeBlock *b = static_cast< FreeBlock* >(p);
+    b->next = pool.free;
+    pool.free = b;
+    _used -= pool.blockSize;
+}
+
+//--------------------------------------------------------------
+inline Arena::Pool& Arena::getPool(size_t size) {
+    size_t blockSize = (std::max(size, sizeof(FreeBlock)) + kAlignment - 1) & ~size_t(kAlignment - 1);
+    for(auto&& pool : _pools) if(pool.blockSize == blockSize) return pool;
+    Pool pool = { blockSize, nullptr, 0 };
+    _pools.push_back(pool);
+    return _pools.back();
+}
+
+//--------------------------------------------------------------
+inline void Arena::addSlab(Pool& pool) {
+    // each slab is as big as all the pool's slabs so far (within limits), so the number of slabs grows slowly
+    size_t numBlocks = std::min(std::max(pool.numBlocks, size_t(kMinSlabBlocks)), size_t(kMaxSlabBlocks));
+    size_t bytes = numBlocks * pool.blockSize;
+    void *raw = malloc(bytes + kAlignment);
+    if(!raw) throw std::bad_alloc();
+    _slabs.push_back(raw);
+    _capacity += bytes;
+    pool.numBlocks += numBlocks;
+
+    // thread the blocks onto the free list, in address order
+    char *c = reinterpret_cast< char* >((reinterpret_cast< uintptr_t >(raw) + kAlignment - 1) & ~uintptr_t(kAlignment - 1));
+    for(size_t i=numBlocks; i>0; i--) {
+        FreeBlock *b = reinterpret_cast< FreeBlock* >(c + (i - 1) * pool.blockSize);
+        b->next = pool.free;
+        pool.free = b;
+    }
+}
+
+}
+}
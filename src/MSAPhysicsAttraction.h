@@ -20,6 +20,7 @@ public:
     typedef shared_ptr< ConstraintT<T> >      Constraint_ptr;
 
     //    friend class WorldT<T>;
+    template <typename> friend class ArenaAllocator;
 
     // create an instance of this class and return a smart pointer
     // this is the only way to instantiate this class
@@ -27,6 +28,11 @@ public:
         return Attraction_ptr(new AttractionT<T>(a, b, strength));
     }
 
+    // the same, in an arena (see WorldT::getAllocator)
+    static Attraction_ptr create(const ArenaAllocator< AttractionT<T> >& alloc, Particle_ptr a, Particle_ptr b, float strength) {
+        return allocate_shared< AttractionT<T> >(alloc, a, b, strength);
+    }
+
 
     Attraction_ptr      setStrength(float s)            { _strength = s; return getThis(); }
     float               getStrength() const             { return _strength; }
@@ -34,13 +40,15 @@ public:
     Attraction_ptr      getThis()                       { return _isInited ? dynamic_pointer_cast< AttractionT<T> >(this->shared_from_this()) : Attraction_ptr(); }
 
     void solve() override {
-        T delta(this->_b->getPosition() - this->_a->getPosition());
+        ParticleT<T> *a = this->getParticleA();
+        ParticleT<T> *b = this->getParticleB();
+        T delta(b->getPosition() - a->getPosition());
         float deltaLength2 = delta.lengthSquared();
-        float force = deltaLength2 > 0 ? _strength * (this->_b->getMass()) * (this->_a->getMass()) / deltaLength2 : 0;
+        float force = deltaLength2 > 0 ? _strength * (b->getMass()) * (a->getMass()) / deltaLength2 : 0;
 
         T deltaForce(delta * force);
-        if (this->_a->isFree()) this->_a->moveBy(deltaForce * this->_a->getInvMass(), false);
-        if (this->_b->isFree()) this->_b->moveBy(deltaForce * -this->_b->getInvMass(), false);
+        if (a->isFree()) this->moveParticle(a, deltaForce * a->getInvMass());
+        if (b->isFree()) this->moveParticle(b, deltaForce * -b->getInvMass());
     }
 
 protected:
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "MSACore.h"
+#include "MSAPhysicsTypes.h"
+
+namespace msa {
+namespace physics {
+
+typedef enum AttractorType {
+    kAttractorPoint,            // pulls towards a point
+    kAttractorLine,             // pulls towards the nearest point on a line through position, along axis
+    kAttractorVortex,           // swirls around a point (2D) or around a line through position, along axis (3D)
+} AttractorType;
+
+typedef enum AttractorFalloff {
+    kFalloffNone,               // the same strength at any distance (within the radius)
+    kFalloffLinear,             // fades to zero at the radius
+    kFalloffInverse,            // strength / distance, the same as AttractionT to a particle with mass 1
+    kFalloffInverseSquare,      // strength / distance^2
+} AttractorFalloff;
+
+
+// a force field which acts on all particles in the world (or those with a collision plane in its mask)
+// one attractor replaces an AttractionT from (say) the mouse to every single particle
+// like constraints, it moves particles once per update (whatever their mass), so negative strength repels
+template <typename T>
+class AttractorT : public enable_shared_from_this< AttractorT<T> > {
+public:
+    typedef shared_ptr< AttractorT<T> >       Attractor_ptr;
+
+    // create an instance of this class and return a smart pointer
+    // this is the only way to instantiate this class
+    static Attractor_ptr create(AttractorType type, const T& pos, float strength) {
+        return Attractor_ptr(new AttractorT<T>(type, pos, strength));
+    }
+
+    Attractor_ptr       getThis()                       { return _isInited ? this->shared_from_this() : Attractor_ptr(); }
+
+    AttractorType       type() const                    { return _type; }
+
+    Attractor_ptr       setPosition(const T& p)         { _pos = p; return getThis(); }
+    const T&            getPosition() const             { return _pos; }
+
+    // direction of the line, or the axis of the vortex (3D only)
+    Attractor_ptr       setAxis(const T& axis);
+    const T&            getAxis() const                 { return _axis; }
+
+    Attractor_ptr       setStrength(float s)            { _strength = s; return getThis(); }
+    float               getStrength() const             { return _strength; }
+
+    // particles further away than the radius aren't affected. 0 for no limit
+    Attractor_ptr       setRadius(float r)              { _radius = r; return getThis(); }
+    float               getRadius() const               { return _radius; }
+
+    Attractor_ptr       setFalloff(AttractorFalloff f)  { _falloff = f; return getThis(); }
+    AttractorFalloff    getFalloff() const              { return _falloff; }
+
+    // only act on particles with a collision plane in this mask (-1 for all)
+    Attractor_ptr       setParticleMask(unsigned int m) { _particleMask = m; return getThis(); }
+    unsigned int        getParticleMask() const         { return _particleMask; }
+
+    void turnOff()                                      { _isOn = false; }
+    void turnOn()                                       { _isOn = true; }
+
+    bool isOn() const                                   { return (_isOn == true); }
+    bool isOff() const                                  { return (_isOn == false); }
+
+    void kill()                                         { _isDead = true; }
+    bool isDead() const                                 { return _isDead; }
+
+    // how far this moves a particle at pos
+    T                   getMove(const T& pos) const;
+
+protected:
+    AttractorType       _type;
+    AttractorFalloff    _falloff;
+    T                   _pos;
+    T                   _axis;
+    float               _strength;
+    float               _radius;
+    unsigned int        _particleMask;
+    bool                _isOn;
+    bool                _isDead;
+    bool                _isInited;
+
+    AttractorT(AttractorType type, const T& pos, float strength);
+};
+
+
+//--------------------------------------------------------------
+template <typename T>
+AttractorT<T>::AttractorT(AttractorType type, const T& pos, float strength) {
+    _isInited = false;
+    _type = type;
+    _falloff = kFalloffInverse;
+    _pos = pos;
+    for(int d=0; d<T::DIM; d++) _axis[d] = d == T::DIM - 1 ? 1 : 0;
+    _strength = strength;
+    _radius = 0;
+    _particleMask = -1;
+    _isOn = true;
+    _isDead = false;
+    _isInited = true;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+typename AttractorT<T>::Attractor_ptr AttractorT<T>::setAxis(const T& axis) {
+    float length = axis.length();
+    if(length > 0) _axis = axis / length;
+    return getThis();
+}
+
+//--------------------------------------------------------------
+template <typename T>
+T AttractorT<T>::getMove(const T& pos) const {
+    // delta is from the particle to the nearest point of the attractor
+    T delta = _pos - pos;
+    if(_type == kAttractorLine || (_type == kAttractorVortex && T::DIM > 2)) {
+        float along = 0;
+        for(int d=0; d<T::DIM; d++) along -= delta[d] * _axis[d];
+        delta += _axis * along;
+    }
+
+    float distance2 = delta.lengthSquared();
+    if(distance2 <= 0 || (_radius > 0 && distance2 > _radius * _radius)) return T();
+    float distance = sqrt(distance2);
+
+    float amount = _strength;
+    switch(_falloff) {
+        case kFalloffNone:          break;
+        case kFalloffLinear:        if(_radius > 0) amount *= 1 - distance / _radius; break;
+        case kFalloffInverse:       amount /= distance; break;
+        case kFalloffInverseSquare: amount /= distance2; break;
+    }
+
+    // a vortex moves particles around the attractor instead of towards it
+    T direction = delta / distance;
+    if(_type == kAttractorVortex) {
+        T tangent;
+        if(T::DIM == 2) {
+            tangent[0] = -direction[1];
+            tangent[1] = direction[0];
+        } else {
+            // axis x direction (2 % DIM so this still compiles in 2D)
+            tangent[0] = _axis[1] * direction[2 % T::DIM] - _axis[2 % T::DIM] * direction[1];
+            tangent[1] = _axis[2 % T::DIM] * direction[0] - _axis[0] * direction[2 % T::DIM];
+            tangent[2 % T::DIM] = _axis[0] * direction[1] - _axis[1] * direction[0];
+        }
+        direction = tangent;
+    }
+
+    return direction * amount;
+}
+
+}
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "MSACore.h"
+#include "MSAPhysicsParticleStore.h"
+#include "MSAPhysicsTypes.h"
+
+namespace msa {
+namespace physics {
+
+// a quadtree (2D) or octree (3D) of the particles in a store, with the total mass and centre of mass of each node
+// used to work out the attraction of every particle to every other in O(N log N), by treating far away nodes as a single particle
+template <typename T>
+class BarnesHutT {
+public:
+    enum { kNumChildren = 1 << T::DIM, kMaxLeafSize = 8, kMaxDepth = 24 };
+
+    BarnesHutT() {}
+
+    // build the tree from all particles in the store with mass
+    void                build(const ParticleStoreT<T>& store);
+
+    // add up the attraction of everything in the tree on slot i: sum of strength * mass * delta / distance^2 (the same as AttractionT)
+    // nodes are treated as a single particle if their size / distance is less than openingAngle
+    T                   getAttraction(const ParticleStoreT<T>& store, long i, float strength, float openingAngle) const;
+
+    bool                empty() const                   { return _nodes.empty(); }
+
+protected:
+    struct Node {
+        T               centre;             // of the cube the node covers
+        float           halfSize;
+        T               centreOfMass;
+        float           mass;
+        int             firstChild;         // children are consecutive, -1 for a leaf
+        long            begin, end;         // range in _order, for leaves
+    };
+
+    vector< Node >      _nodes;
+    vector< long >      _order;             // particle slots, grouped by leaf
+    vector< long >      _scratch;
+
+    void                buildNode(const ParticleStoreT<T>& store, int n, int depth);
+    int                 getChildIndex(const ParticleStoreT<T>& store, const Node& node, long i) const;
+};
+
+
+//--------------------------------------------------------------
+template <typename T>
+void BarnesHutT<T>::build(const ParticleStoreT<T>& store) {
+    _nodes.clear();
+    _order.clear();
+
+    T minPos, maxPos;
+    for(int d=0; d<T::DIM; d++) {
+        minPos[d] = FLT_MAX;
+        maxPos[d] = -FLT_MAX;
+    }
+    for(long i=0; i<store.size(); i++) {
+        if(store.mass[i] <= 0) continue;
+        _order.push_back(i);
+        for(int d=0; d<T::DIM; d++) {
+            minPos[d] = std::min(minPos[d], store.pos[d][i]);
+            maxPos[d] = std::max(maxPos[d], store.pos[d][i]);
+        }
+    }
+    if(_order.empty()) return;
+
+    Node root;
+    root.halfSize = 0;
+    for(int d=0; d<T::DIM; d++) {
+        root.centre[d] = (minPos[d] + maxPos[d]) * 0.5f;
+        root.halfSize = std::max(root.halfSize, (maxPos[d] - minPos[d]) * 0.5f);
+    }
+    root.begin = 0;
+    root.end = _order.size();
+    _nodes.push_back(root);
+    buildNode(store, 0, 0);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+int BarnesHutT<T>::getChildIndex(const ParticleStoreT<T>& store, const Node& node, long i) const {
+    int c = 0;
+    for(int d=0; d<T::DIM; d++) if(store.pos[d][i] >= node.centre[d]) c |= 1 << d;
+    return c;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void BarnesHutT<T>::buildNode(const ParticleStoreT<T>& store, int n, int depth) {
+    // (_nodes might grow while building children, so always go through the index)
+    long begin = _nodes[n].begin;
+    long end = _nodes[n].end;
+
+    // small enough (or all particles on top of each other) to be a leaf
+    if(end - begin <= kMaxLeafSize || depth >= kMaxDepth || _nodes[n].halfSize <= 0) {
+        _nodes[n].firstChild = -1;
+        float mass = 0;
+        T centreOfMass;
+        for(long k=begin; k<end; k++) {
+            long i = _order[k];
+            mass += store.mass[i];
+            centreOfMass += store.getPosition(i) * store.mass[i];
+        }
+        _nodes[n].mass = mass;
+        _nodes[n].centreOfMass = centreOfMass / mass;
+        return;
+    }
+
+    // counting sort of the node's particles by child
+    long counts[kNumChildren + 1] = { 0 };
+    for(long k=begin; k<end; k++) counts[getChildIndex(store, _nodes[n], _order[k]) + 1]++;
+    for(int c=1; c<=kNumChildren; c++) counts[c] += counts[c - 1];
+    _scratch.resize(end - begin);
+    long next[kNumChildren];
+    for(int c=0; c<kNumChildren; c++) next[c] = counts[c];
+    for(long k=begin; k<end; k++) {
+        long i = _order[k];
+        _scratch[next[getChildIndex(store, _nodes[n], i)]++] = i;
+    }
+    copy(_scratch.begin(), _scratch.begin() + (end - begin), _order.begin() + begin);
+
+    int firstChild = _nodes.size();
+    _nodes[n].firstChild = firstChild;
+    for(int c=0; c<kNumChildren; c++) {
+        Node child;
+        child.halfSize = _nodes[n].halfSize * 0.5f;
+        for(int d=0; d<T::DIM; d++) child.centre[d] = _nodes[n].centre[d] + ((c >> d) & 1 ? child.halfSize : -child.halfSize);
+        child.begin = begin + counts[c];
+        child.end = begin + counts[c + 1];
+        child.mass = 0;
+        child.firstChild = -1;
+        _nodes.push_back(child);
+    }
+
+    float mass = 0;
+    T centreOfMass;
+    for(int c=0; c<kNumChildren; c++) {
+        if(_nodes[firstChild + c].begin == _nodes[firstChild + c].end) continue;
+        buildNode(store, firstChild + c, depth + 1);
+        mass += _nodes[firstChild + c].mass;
+        centreOfMass += _nodes[firstChild + c].centreOfMass * _nodes[firstChild + c].mass;
+    }
+    _nodes[n].mass = mass;
+    _nodes[n].centreOfMass = centreOfMass / mass;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+T BarnesHutT<T>::getAttraction(const ParticleStoreT<T>& store, long i, float strength, float openingAngle) const {
+    T sum;
+    if(_nodes.empty()) return sum;
+
+    T pos = store.getPosition(i);
+    float openingAngle2 = openingAngle * openingAngle;
+
+    int stack[kMaxDepth * kNumChildren + 1];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while(stackSize) {
+        const Node& node = _nodes[stack[--stackSize]];
+        if(node.mass <= 0) continue;
+
+        if(node.firstChild < 0) {
+            for(long k=node.begin; k<node.end; k++) {
+                long j = _order[k];
+                if(j == i) continue;
+                T delta = store.getPosition(j) - pos;
+                float deltaLength2 = delta.lengthSquared();
+                if(deltaLength2 > 0) sum += delta * (store.mass[j] / deltaLength2);
+            }
+            continue;
+        }
+
+        T delta = node.centreOfMass - pos;
+        float deltaLength2 = delta.lengthSquared();
+        float size = node.halfSize * 2;
+        if(size * size < openingAngle2 * deltaLength2) {
+            sum += delta * (node.mass / deltaLength2);
+        } else {
+            for(int c=0; c<kNumChildren; c++) stack[stackSize++] = node.firstChild + c;
+        }
+    }
+    return sum * strength;
+}
+
+}
+}
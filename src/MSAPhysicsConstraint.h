@@ -2,6 +2,7 @@
 
 #include "MSACore.h"
 #include "MSAPhysicsParticle.h"
+#include "MSAPhysicsHandle.h"
 #include "MSAPhysicsTypes.h"
 
 namespace msa {
@@ -27,7 +28,9 @@ public:
     typedef shared_ptr< AttractionT<T> >      Attraction_ptr;
     typedef shared_ptr< ConstraintT<T> >      Constraint_ptr;
 
-//    friend class WorldT<T>;
+    friend class WorldT<T>;
+    friend class ParticleT<T>;                                      // for queueRemoval
+    template <typename, typename> friend class ConstraintListT;     // for debugDraw
 
     // virtual destructor needed in case we extend the class and delete via the base class
     virtual ~ConstraintT() {}
@@ -42,14 +45,22 @@ public:
     Particle_ptr getA() const                           { return _a; }
     Particle_ptr getB() const                           { return _b; }
 
+    // the same without touching reference counts, for when you only need the particle for a moment
+    ParticleT<T>* getParticleA() const                  { return _a.get(); }
+    ParticleT<T>* getParticleB() const                  { return _b.get(); }
+
+    // lightweight reference to this constraint, while it's in a world (null otherwise). see WorldT::getConstraint(ConstraintHandle)
+    ConstraintHandle getHandle() const                  { return _handle; }
+
     void turnOff()                                      { _isOn = false; }
     void turnOn()                                       { _isOn = true; }
 
     bool isOn() const                                   { return (_isOn == true); }
     bool isOff() const                                  { return (_isOn == false); }
 
-    void kill()                                         { _isDead = true; }
-    bool isDead() const                                 { return _isDead || (_a && _a->isDead()) || (_b && _b->isDead()) || !_a || !_b; }
+    // the constraint is removed in the world's next update
+    void kill()                                         { if(!_isDead) queueRemoval(); _isDead = true; }
+    bool isDead() const;
 
     // set minimum distance before constraint takes affect
     void setMinDistance(float d)                        { _minDist = d; _minDist2 = d*d; }
@@ -72,8 +83,11 @@ public:
     virtual void solve() = 0;
 
 protected:
-    Particle_ptr _a, _b;
+    Particle_ptr _a, _b;        // keep the ends alive. solvers go through getParticleA/B, so they don't touch the reference counts
     ConstraintType	_type;
+    ConstraintHandle _handle;
+    vector< ConstraintHandle > *_removalQueue;     // the world's queue of constraints to remove, while in a world
+    long            _listIndex;                     // position in the world's list for its class
 
     bool			_isOn;
     bool			_isDead;
@@ -83,14 +97,18 @@ protected:
     float			_maxDist2;
 
     ConstraintT(Particle_ptr a, Particle_ptr b, ConstraintType type = kConstraintTypeCustom):
-        _a(a), _b(b), _type(type), _isOn(true), _isDead(false)
-
+        _a(a), _b(b), _type(type), _removalQueue(nullptr), _listIndex(-1), _isOn(true), _isDead(false)
     {
         setMinDistance(0);
         setMaxDistance(0);
     }
 
 
+    void queueRemoval()                                 { if(_removalQueue) _removalQueue->push_back(_handle); }
+
+    // for solve(): move an end (with the velocity it gives it)
+    static void moveParticle(ParticleT<T> *p, const T& offset)  { p->displace(offset, false); }
+
     virtual void debugDraw() {
         //ofLine(_a->x, _a->y, _b->x, _b->y);
         /*
@@ -207,18 +225,28 @@ protected:
 //    return _maxDist;
 //}
 
+//--------------------------------------------------------------
+template <typename T>
+bool ConstraintT<T>::isDead() const {
+    ParticleT<T> *a = getParticleA();
+    ParticleT<T> *b = getParticleB();
+    return _isDead || !a || !b || a->isDead() || b->isDead();
+}
+
 //--------------------------------------------------------------
 // only worth solving the constraint if its on, and at least one end is free
 template <typename T>
 bool ConstraintT<T>::shouldSolve() const {
+    ParticleT<T> *a = getParticleA();
+    ParticleT<T> *b = getParticleB();
 
-    // if the constraint is off or both sides are fixed then return false
-    if(isOff() || (_a->isFixed() && _b->isFixed())) return false;
+    // if the constraint is off or both sides are fixed (or asleep) then return false
+    if(isOff() || ((a->isFixed() || a->isSleeping()) && (b->isFixed() || b->isSleeping()))) return false;
 
     // if no length restrictions then return true
     if(_minDist == 0 && _maxDist == 0) return true;
 
-    T delta(_b->getPosition() - _a->getPosition());
+    T delta(b->getPosition() - a->getPosition());
     float deltaLength2 = delta.lengthSquared();
 
     bool minDistSatisfied;
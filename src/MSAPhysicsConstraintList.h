@@ -0,0 +1,141 @@
+#pragma once
+
+#include "MSACore.h"
+#include "MSAPhysicsConstraint.h"
+#include "MSAPhysicsTypes.h"
+
+namespace msa {
+namespace physics {
+
+// the world keeps one list per constraint class, so the solver loop for each doesn't make a virtual call per constraint
+// this is the interface the world talks to the lists through: virtual calls here are once per list, not once per constraint
+template <typename T>
+class ConstraintListBaseT {
+public:
+    typedef shared_ptr< ConstraintT<T> >      Constraint_ptr;
+    typedef HandleTableT< ConstraintHandle, ConstraintT<T>* >   HandleTable;
+
+    virtual ~ConstraintListBaseT() {}
+
+    virtual ConstraintType      type() const = 0;
+    virtual long                size() const = 0;
+    virtual Constraint_ptr      get(long i) const = 0;
+
+    // only add constraints which this list is for (see accepts)
+    virtual bool                accepts(const ConstraintT<T>& c) const = 0;
+    virtual void                add(Constraint_ptr c) = 0;
+
+    virtual void                reserve(long i) = 0;
+    virtual void                clear() = 0;
+    virtual void                remove(ConstraintT<T>& c) = 0;  // the last one takes its place. c might be deleted when this returns
+
+    // solve all constraints once
+    virtual void                solve() = 0;
+
+    virtual void                draw() = 0;
+    virtual void                debugDraw() = 0;
+};
+
+
+// constraints of class C (and its subclasses, if the list is for a built in type)
+// constraints of exactly class C are solved with a direct call to C::solve(), which the compiler can inline
+template <typename T, typename C>
+class ConstraintListT : public ConstraintListBaseT<T> {
+public:
+    typedef shared_ptr< ConstraintT<T> >      Constraint_ptr;
+    typedef shared_ptr< C >                   C_ptr;
+
+    // type: the ConstraintType of the constraints in this list
+    // acceptSubclasses: whether to take subclasses of C as well (they are solved with their own solve())
+    ConstraintListT(ConstraintType type, bool acceptSubclasses) : _type(type), _acceptSubclasses(acceptSubclasses) {}
+
+    vector< C_ptr >&            getConstraints()                { return _constraints; }
+    const vector< C_ptr >&      getConstraints() const          { return _constraints; }
+    C_ptr                       getConstraint(long i) const     { return i < size() ? _constraints[i] : nullptr; }
+
+    ConstraintType              type() const override           { return _type; }
+    long                        size() const override           { return _constraints.size(); }
+    Constraint_ptr              get(long i) const override      { return getConstraint(i); }
+
+    bool                        accepts(const ConstraintT<T>& c) const override;
+    void                        add(Constraint_ptr c) override  { c->_listIndex = _constraints.size(); _constraints.push_back(static_pointer_cast< C >(c)); _isExactType.push_back(isExactType(*c)); }
+
+    void                        reserve(long i) override        { _constraints.reserve(i); _isExactType.reserve(i); }
+    void                        clear() override                { _constraints.clear(); _isExactType.clear(); }
+    void                        remove(ConstraintT<T>& c) override;
+    void                        solve() override;
+
+    void                        draw() override                 { for(auto&& c : _constraints) c->draw(); }
+    void                        debugDraw() override            { for(auto&& c : _constraints) static_cast< ConstraintT<T>* >(c.get())->debugDraw(); }
+
+protected:
+    vector< C_ptr >             _constraints;
+    vector< unsigned char >     _isExactType;       // whether each constraint is exactly a C, so it can skip the virtual call
+    ConstraintType              _type;
+    bool                        _acceptSubclasses;
+
+    static bool                 isExactType(const ConstraintT<T>& c)    { return !is_abstract< C >::value && typeid(c) == typeid(C); }
+    static void                 setListIndex(ConstraintT<T>& c, long i) { c._listIndex = i; }
+
+    // (C::solve() can't be called directly if it's pure virtual)
+    static void                 solveExact(C& c, false_type)    { c.C::solve(); }
+    static void                 solveExact(C& c, true_type)     { c.solve(); }
+
+    // constraints might have been added straight into getConstraints()
+    void                        updateExactTypes();
+};
+
+
+//--------------------------------------------------------------
+template <typename T, typename C>
+bool ConstraintListT<T, C>::accepts(const ConstraintT<T>& c) const {
+    if(c.type() != _type) return false;
+    if(_acceptSubclasses) return is_same< C, ConstraintT<T> >::value || dynamic_cast< const C* >(&c) != nullptr;
+    return typeid(c) == typeid(C);
+}
+
+//--------------------------------------------------------------
+template <typename T, typename C>
+void ConstraintListT<T, C>::updateExactTypes() {
+    if(_isExactType.size() == _constraints.size()) return;
+    _isExactType.resize(_constraints.size());
+    for(size_t i=0; i<_constraints.size(); i++) {
+        _isExactType[i] = isExactType(*_constraints[i]);
+        setListIndex(*_constraints[i], i);
+    }
+}
+
+//--------------------------------------------------------------
+template <typename T, typename C>
+void ConstraintListT<T, C>::remove(ConstraintT<T>& c) {
+    updateExactTypes();
+    long i = c._listIndex;
+    if(i < 0 || i >= size() || _constraints[i].get() != &c) return;
+
+    // swap the last one into its place (hold on to c until we're done with the list)
+    C_ptr removed = move(_constraints[i]);
+    setListIndex(c, -1);
+    long last = size() - 1;
+    if(i != last) {
+        _constraints[i] = move(_constraints[last]);
+        _isExactType[i] = _isExactType[last];
+        setListIndex(*_constraints[i], i);
+    }
+    _constraints.pop_back();
+    _isExactType.pop_back();
+}
+
+//--------------------------------------------------------------
+template <typename T, typename C>
+void ConstraintListT<T, C>::solve() {
+    updateExactTypes();
+    for(size_t i=0; i<_constraints.size(); i++) {
+        C &c = *_constraints[i];
+        if(!c.shouldSolve()) continue;
+        if(_isExactType[i]) solveExact(c, typename is_abstract< C >::type());
+        else c.solve();
+    }
+}
+
+}
+}
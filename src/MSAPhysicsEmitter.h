@@ -0,0 +1,204 @@
+#pragma once
+
+#include "MSACore.h"
+#include "MSAPhysicsParticle.h"
+#include "MSAPhysicsTypes.h"
+#include <cstdint>
+
+namespace msa {
+namespace physics {
+
+// spawns particles into the world every update, which die of old age after their lifetime
+// the particles come from a pool which is made once, and go back into it when they've left the world
+// so once the world's arrays have grown to fit (after the first lifetime or so), emitting doesn't allocate anything
+template <typename T>
+class EmitterT : public enable_shared_from_this< EmitterT<T> > {
+public:
+    typedef shared_ptr< EmitterT<T> >         Emitter_ptr;
+    typedef shared_ptr< ParticleT<T> >        Particle_ptr;
+
+    friend class WorldT<T>;
+
+    // create an instance of this class and return a smart pointer
+    // this is the only way to instantiate this class
+    static Emitter_ptr create(const T& pos, float rate, float lifetime) {
+        return Emitter_ptr(new EmitterT<T>(pos, rate, lifetime));
+    }
+
+    Emitter_ptr         getThis()                       { return _isInited ? this->shared_from_this() : Emitter_ptr(); }
+
+    // particles per update (fractions carry over to the next update)
+    Emitter_ptr         setRate(float r)                { _rate = r; return getThis(); }
+    float               getRate() const                 { return _rate; }
+
+    // emit n particles (as well as the rate) in the next update
+    Emitter_ptr         burst(long n)                   { _burst += n; return getThis(); }
+
+    // in updates, 0 for particles which live until they're killed. each particle gets lifetime +- lifetimeSpread/2
+    Emitter_ptr         setLifetime(float l)            { _lifetime = l; return getThis(); }
+    float               getLifetime() const             { return _lifetime; }
+    Emitter_ptr         setLifetimeSpread(float s)      { _lifetimeSpread = s; return getThis(); }
+    float               getLifetimeSpread() const       { return _lifetimeSpread; }
+
+    // particles start in a box of size positionSpread around the position
+    Emitter_ptr         setPosition(const T& p)         { _pos = p; return getThis(); }
+    const T&            getPosition() const             { return _pos; }
+    Emitter_ptr         setPositionSpread(const T& s)   { _posSpread = s; return getThis(); }
+    const T&            getPositionSpread() const       { return _posSpread; }
+
+    // starting velocity (distance per update, as in ParticleT::addVelocity), +- velocitySpread/2 on each axis
+    Emitter_ptr         setVelocity(const T& v)         { _vel = v; return getThis(); }
+    const T&            getVelocity() const             { return _vel; }
+    Emitter_ptr         setVelocitySpread(const T& s)   { _velSpread = s; return getThis(); }
+    const T&            getVelocitySpread() const       { return _velSpread; }
+
+    // settings for the particles
+    Emitter_ptr         setMass(float m)                { _mass = m; return getThis(); }
+    float               getMass() const                 { return _mass; }
+    Emitter_ptr         setDrag(float d)                { _drag = d; return getThis(); }
+    float               getDrag() const                 { return _drag; }
+    Emitter_ptr         setBounce(float b)              { _bounce = b; return getThis(); }
+    float               getBounce() const               { return _bounce; }
+    Emitter_ptr         setRadius(float r)              { _radius = r; return getThis(); }
+    float               getRadius() const               { return _radius; }
+    Emitter_ptr         setCollisionPlane(unsigned int c)   { _collisionPlane = c; return getThis(); }
+    unsigned int        getCollisionPlane() const       { return _collisionPlane; }
+    Emitter_ptr         enableCollision()               { _hasCollision = true; return getThis(); }
+    Emitter_ptr         disableCollision()              { _hasCollision = false; return getThis(); }
+    bool                hasCollision() const            { return _hasCollision; }
+
+    // the most particles alive at once, which is the size of the pool
+    // the pool is made (or grown) in the next update, it never shrinks
+    Emitter_ptr         setMaxParticles(long n)         { _maxParticles = n; return getThis(); }
+    long                getMaxParticles() const         { return _maxParticles; }
+
+    // particles from this emitter in the world (until the next update, this includes those which died in the last one)
+    long                numberOfParticles() const       { return _alive.size(); }
+    Particle_ptr        getParticle(long i) const       { return i < numberOfParticles() ? _pool[_alive[i]] : nullptr; }
+
+    // turned off emitters don't emit, but their particles live on
+    void turnOff()                                      { _isOn = false; }
+    void turnOn()                                       { _isOn = true; }
+
+    bool isOn() const                                   { return (_isOn == true); }
+    bool isOff() const                                  { return (_isOn == false); }
+
+    // the world drops killed emitters in its next update (their particles live on)
+    void kill()                                         { _isDead = true; }
+    bool isDead() const                                 { return _isDead; }
+
+protected:
+    T                   _pos, _posSpread;
+    T                   _vel, _velSpread;
+    float               _rate;
+    float               _toEmit;            // fractions of particles left over from previous updates
+    long                _burst;
+    float               _lifetime, _lifetimeSpread;
+    float               _mass, _drag, _bounce, _radius;
+    unsigned int        _collisionPlane;
+    bool                _hasCollision;
+    long                _maxParticles;
+    uint32_t            _seed;
+
+    vector< Particle_ptr >  _pool;
+    vector< long >      _free;              // indices into the pool, of particles not in the world
+    vector< long >      _alive;             // and of those which are
+
+    bool                _isOn;
+    bool                _isDead;
+    bool                _isInited;
+
+    EmitterT(const T& pos, float rate, float lifetime);
+
+    // put particles which have left the world back in the pool, and emit new ones into world
+    void                update(WorldT<T>& world);
+
+    // -1...1 (not thread safe, only used in update)
+    float               random()                        { _seed = _seed * 1664525 + 1013904223; return (_seed >> 8) * (2.0f / 16777216.0f) - 1; }
+    T                   random(const T& size);
+};
+
+
+//--------------------------------------------------------------
+template <typename T>
+EmitterT<T>::EmitterT(const T& pos, float rate, float lifetime) {
+    _isInited = false;
+    _pos = pos;
+    _toEmit = 0;
+    _burst = 0;
+    _seed = 1;
+    setRate(rate);
+    setLifetime(lifetime);
+    setLifetimeSpread(0);
+    setMass(1);
+    setDrag(1);
+    setBounce(1);
+    setRadius(15);
+    setCollisionPlane(0xFFFFFFFF);
+    enableCollision();
+    setMaxParticles(1000);
+    turnOn();
+    _isDead = false;
+    _isInited = true;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+T EmitterT<T>::random(const T& size) {
+    T r;
+    for(int d=0; d<T::DIM; d++) r[d] = size[d] ? random() * size[d] * 0.5f : 0;
+    return r;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void EmitterT<T>::update(WorldT<T>& world) {
+    // particles lose their handle when they're taken out of the world (killed, or died of old age)
+    for(size_t i=0; i<_alive.size(); ) {
+        if(!_pool[_alive[i]]->getHandle().isNull()) { i++; continue; }
+        _free.push_back(_alive[i]);
+        _alive[i] = _alive.back();
+        _alive.pop_back();
+    }
+
+    // grow the pool up front, so nothing is allocated while emitting
+    if((long)_pool.size() < _maxParticles) {
+        _free.reserve(_maxParticles);
+        _alive.reserve(_maxParticles);
+        for(long i=_pool.size(); i<_maxParticles; i++) {
+            _pool.push_back(ParticleT<T>::create(world.template getAllocator< ParticleT<T> >(), _pos));
+            _free.push_back(i);
+        }
+    }
+
+    if(isOff()) {
+        _toEmit = 0;
+        _burst = 0;
+        return;
+    }
+
+    _toEmit += _rate;
+    long n = (long)_toEmit;
+    _toEmit -= n;
+    n += _burst;
+    _burst = 0;
+
+    // the pool might have free particles past a lowered max
+    for(; n > 0 && !_free.empty() && (long)_alive.size() < _maxParticles; n--) {
+        long i = _free.back();
+        _free.pop_back();
+        ParticleT<T> &p = *_pool[i];
+        p.init(_pos + random(_posSpread), _mass, _drag);
+        p.setBounce(_bounce);
+        p.setRadius(_radius);
+        p.setCollisionPlane(_collisionPlane);
+        if(!_hasCollision) p.disableCollision();
+        p.setLifetime(_lifetime > 0 ? std::max(_lifetime + random() * _lifetimeSpread * 0.5f, 1.0f) : 0);
+        p.addVelocity(_vel + random(_velSpread));
+        world.addParticle(_pool[i]);
+        _alive.push_back(i);
+    }
+}
+
+}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "MSACore.h"
+#include <cstdint>
+
+namespace msa {
+namespace physics {
+
+// a lightweight reference to a particle or constraint in a world: an index into one of the world's handle tables, and the generation of that entry
+// when the particle or constraint is removed from the world its entry's generation goes up, so a stale handle is spotted in O(1)
+// handles don't keep anything alive, and copying them doesn't touch any reference counts
+template <typename Tag>
+struct HandleT {
+    enum { kNull = 0xffffffff };
+
+    uint32_t    index;
+    uint32_t    generation;
+
+    HandleT() : index(kNull), generation(0) {}
+    HandleT(uint32_t i, uint32_t g) : index(i), generation(g) {}
+
+    bool        isNull() const                          { return index == kNull; }
+
+    bool        operator==(const HandleT& h) const      { return index == h.index && generation == h.generation; }
+    bool        operator!=(const HandleT& h) const      { return !(*this == h); }
+    bool        operator<(const HandleT& h) const       { return index < h.index || (index == h.index && generation < h.generation); }
+};
+
+struct ParticleHandleTag;
+struct ConstraintHandleTag;
+typedef HandleT< ParticleHandleTag >    ParticleHandle;
+typedef HandleT< ConstraintHandleTag >  ConstraintHandle;
+
+
+// generations and values (e.g. the slot a particle is in) of handles H. removed entries are reused
+template <typename H, typename V>
+class HandleTableT {
+public:
+    H           add(const V& value);
+    void        remove(const H& h);
+    void        clear();                                // invalidates all handles
+
+    bool        isValid(const H& h) const               { return h.index < _generations.size() && _generations[h.index] == h.generation; }
+    V           get(const H& h, const V& fallback) const    { return isValid(h) ? _values[h.index] : fallback; }
+
+    // for the owner of the table to keep the value of an entry up to date
+    void        set(uint32_t index, const V& value)     { _values[index] = value; }
+    H           getHandle(uint32_t index) const         { return H(index, _generations[index]); }
+
+protected:
+    vector< uint32_t >  _generations;
+    vector< V >         _values;
+    vector< uint32_t >  _free;
+};
+
+
+//--------------------------------------------------------------
+template <typename H, typename V>
+H HandleTableT<H, V>::add(const V& value) {
+    uint32_t i;
+    if(_free.empty()) {
+        i = _generations.size();
+        _generations.push_back(0);
+        _values.push_back(value);
+    } else {
+        i = _free.back();
+        _free.pop_back();
+        _values[i] = value;
+    }
+    return H(i, _generations[i]);
+}
+
+//--------------------------------------------------------------
+template <typename H, typename V>
+void HandleTableT<H, V>::remove(const H& h) {
+    if(!isValid(h)) return;
+    _generations[h.index]++;
+    _free.push_back(h.index);
+}
+
+//--------------------------------------------------------------
+template <typename H, typename V>
+void HandleTableT<H, V>::clear() {
+    // bump every generation (even of free entries, it doesn't matter) and free everything
+    _free.resize(_generations.size());
+    for(size_t i=0; i<_generations.size(); i++) {
+        _generations[i]++;
+        _free[i] = _generations.size() - 1 - i;
+    }
+}
+
+}
+}
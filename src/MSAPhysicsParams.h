@@ -5,6 +5,11 @@
 namespace msa {
 namespace physics {
 
+typedef enum BroadphaseType {
+    kBroadphaseSectors,
+    kBroadphaseSweepAndPrune,
+} BroadphaseType;
+
 template <typename T>
 struct ParamsT {
     float   timeStep, timeStep2;
@@ -23,7 +28,37 @@ struct ParamsT {
     T		worldSize;                  // cache these
     //    T		worldSizeInv;
     T		sectorCount;				// number of sectors in each axis
+    T		sectorSizeInv;              // cache this
+    bool	doAutoSectorCount;          // work out sector count from the largest particle
+    bool	doMultiLevelSectors;        // hierarchy of sector sizes for mixed particle sizes
+    BroadphaseType  broadphase;
+
+
+
+    // reuse candidate collision pairs across frames
+    bool	doNeighbourList;
+    float	neighbourSkin;              // extra distance around each particle when finding candidate pairs
+
+    // every particle attracting every other, through a Barnes-Hut tree
+    bool	doGlobalAttraction;
+    float	globalAttractionStrength;
+    float	openingAngle;               // nodes smaller than this times their distance are treated as one particle
+
+    // attraction (or repulsion) between particles closer than a cutoff, through the sectors
+    bool	doShortRangeForce;
+    float	shortRangeStrength;
+    float	shortRangeCutoff;
+
+    // spatial queries
+    float	queryCellSize;              // 0 to work it out from the number of particles
+
+    // put particles (and their constraint islands) to sleep once they've been still for a while
+    bool	doSleeping;
+    float	sleepSpeed;                 // distance per update below which a particle counts as still
+    int		sleepFrames;                // updates in a row it has to be still for
+
 };
 
+
 }
 }
@@ -3,6 +3,8 @@
 #include "MSACore.h"
 #include "MSAPhysicsParams.h"
 #include "MSAPhysicsTypes.h"
+#include "MSAPhysicsParticleStore.h"
+#include "MSAPhysicsArena.h"
 
 namespace msa {
 namespace physics {
@@ -27,35 +29,55 @@ public:
         return Particle_ptr(new ParticleT<T>(pos, mass, drag));
     }
 
+    // the same, in an arena (see WorldT::getAllocator)
+    static Particle_ptr create(const ArenaAllocator< ParticleT<T> >& alloc, const T& pos = T(), float mass = 1.0f, float drag = 1.0f) {
+        return allocate_shared< ParticleT<T> >(alloc, pos, mass, drag);
+    }
+
     virtual void        init(const T& pos = T(), float mass = 1.0f, float drag = 1.0f);
 
     Particle_ptr        setMass(float t = 1);
-    float               getMass() const                 { return _mass; }
-    float               getInvMass() const              { return _invMass; }
+    float               getMass() const                 { return field(&Store::mass, &State::mass); }
+    float               getInvMass() const              { return field(&Store::invMass, &State::invMass); }
+
+    Particle_ptr        setDrag(float t = 1)            { field(&Store::drag, &State::drag) = t; return getThis(); }
+    float               getDrag() const                 { return field(&Store::drag, &State::drag); }
+
+    Particle_ptr        setBounce(float t = 1)          { field(&Store::bounce, &State::bounce) = t; return getThis(); }
+    float               getBounce() const               { return field(&Store::bounce, &State::bounce); }
 
-    Particle_ptr        setDrag(float t = 1)            { _drag = t; return getThis(); }
-    float               getDrag() const                 { return _drag; }
+    Particle_ptr        setRadius(float t = 15)         { wake(); field(&Store::radius, &State::radius) = t; return getThis(); }
+    float               getRadius() const               { return field(&Store::radius, &State::radius); }
 
-    Particle_ptr        setBounce(float t = 1)          { _bounce = t; return getThis(); }
-    float               getBounce()                     { return _bounce; }
+    // age in updates, since the particle was made (or init'ed)
+    float               getAge() const                  { return field(&Store::age, &State::age); }
 
-    Particle_ptr        setRadius(float t = 15)         { _radius = t; return getThis(); }
-    float               getRadius()                     { return _radius; }
+    // the particle is killed when its age reaches its lifetime (in updates). 0 to live forever
+    Particle_ptr        setLifetime(float t = 0)        { field(&Store::lifetime, &State::lifetime) = t; return getThis(); }
+    float               getLifetime() const             { return field(&Store::lifetime, &State::lifetime); }
 
     // collision methods
-    Particle_ptr        enableCollision()               { _collisionEnabled = true; return getThis(); }
-    Particle_ptr        disableCollision()              { _collisionEnabled = false; return getThis(); }
-    bool                hasCollision() const            { return _collisionEnabled; }
+    Particle_ptr        enableCollision()               { setFlag(kParticleFlagCollision, true); return getThis(); }
+    Particle_ptr        disableCollision()              { setFlag(kParticleFlagCollision, false); return getThis(); }
+    bool                hasCollision() const            { return hasFlag(kParticleFlagCollision); }
 
     // passive particles do not collied with each other, only with non-passive (collision must be enabled)
-    Particle_ptr        enablePassiveCollision()        { _passiveCollision = true; return getThis(); }
-    Particle_ptr        disablePassiveCollision()       { _passiveCollision = false; return getThis(); }
-    bool                hasPassiveCollision() const     { return _passiveCollision; }
+    Particle_ptr        enablePassiveCollision()        { setFlag(kParticleFlagPassiveCollision, true); return getThis(); }
+    Particle_ptr        disablePassiveCollision()       { setFlag(kParticleFlagPassiveCollision, false); return getThis(); }
+    bool                hasPassiveCollision() const     { return hasFlag(kParticleFlagPassiveCollision); }
 
-    bool                isFixed() const                 { return (_isFixed); }
-    bool                isFree() const                  { return (!_isFixed); }
-    Particle_ptr        makeFixed()                     { _isFixed = true; return getThis(); }
-    Particle_ptr        makeFree()                      { _oldPos = _pos; _isFixed = false; return getThis(); }
+    // only particles sharing bits in the collision plane collide with each other
+    Particle_ptr        setCollisionPlane(unsigned int c)   { wake(); field(&Store::collisionPlane, &State::collisionPlane) = c; return getThis(); }
+    unsigned int        getCollisionPlane() const       { return field(&Store::collisionPlane, &State::collisionPlane); }
+
+    bool                isFixed() const                 { return hasFlag(kParticleFlagFixed); }
+    bool                isFree() const                  { return !hasFlag(kParticleFlagFixed); }
+    Particle_ptr        makeFixed()                     { wake(); setFlag(kParticleFlagFixed, true); return getThis(); }
+    Particle_ptr        makeFree()                      { wake(); setOldPosition(getPosition()); setFlag(kParticleFlagFixed, false); return getThis(); }
+
+    // see WorldT::enableSleeping. moving a particle, or changing its velocity, mass, radius or collision plane, wakes it (and its island) too
+    bool                isSleeping() const              { return hasFlag(kParticleFlagSleeping); }
+    Particle_ptr        wakeUp()                        { wake(); return getThis(); }
 
     // quick way of enabling (collision and update) and disabling
     Particle_ptr        enable()                        { enableCollision(); makeFree(); return getThis(); }
@@ -68,11 +90,12 @@ public:
     Particle_ptr        moveBy(const T& offset, bool preserveVelocity = true);
     Particle_ptr        setOldPosition(const T& o);
 
-    T                   getPosition() const             { return _pos; }
+    T                   getPosition() const             { return _store ? _store->getPosition(_slot) : _state.pos; }
+    T                   getOldPosition() const          { return _store ? _store->getOldPosition(_slot) : _state.oldPos; }
 
-    Particle_ptr        setVelocity(const T& vel)       { _oldPos = _pos - vel; return getThis(); }
-    Particle_ptr        addVelocity(const T& vel)       { _oldPos -= vel; return getThis(); }
-    T                   getVelocity() const             { return _pos - _oldPos; }
+    Particle_ptr        setVelocity(const T& vel)       { wake(); setOldPosition(getPosition() - vel); return getThis(); }
+    Particle_ptr        addVelocity(const T& vel)       { wake(); setOldPosition(getOldPosition() - vel); return getThis(); }
+    T                   getVelocity() const             { return getPosition() - getOldPosition(); }
 
     // override these functions if you create your own particle type with custom behaviour and/or drawing
     virtual void        update() {}		// called every frame in world::update();
@@ -82,35 +105,60 @@ public:
     virtual void        collidedWithParticle(ParticleT<T>& other, const T& collisionForce) {}
     virtual void        collidedWithEdgeOfWorld(const T& collisionForce) {}
 
-    void                kill()                          { _isDead = true; }
-    bool                isDead() const                  { return _isDead; }
+    // the particle (and its constraints) are removed in the world's next update
+    void                kill();
+    bool                isDead() const                  { return hasFlag(kParticleFlagDead); }
 
     Particle_ptr        getThis()                       { return _isInited ? this->shared_from_this() : Particle_ptr(); }
 
+    // lightweight reference to this particle, while it's in a world (null otherwise). see WorldT::getParticle(ParticleHandle)
+    ParticleHandle      getHandle() const               { return _store ? _store->getHandle(_slot) : ParticleHandle(); }
+
+    // constraints attached to this particle (added to a world with addConstraint or make...)
+    // killed constraints (and those of a killed particle) stay in here until the world's next update
+    const vector< ConstraintT<T>* >& getConstraints() const { return _constraints; }
+
     // custom void* which you can use to store any kind of custom data without extending the class
     // very old school, i might scrap it
     void                *data;
 
-    // only particles sharing bits in the collision plane collide with each other
-    unsigned int        collisionPlane;
-
 protected:
-    T				_pos;
-    T				_oldPos;
-    float			_mass, _invMass;
-    float			_drag;
-    float			_bounce;
-    float			_radius;
-    float			_age;
-    bool			_isDead;
-    bool			_isFixed;
-    bool			_collisionEnabled;
-    bool            _passiveCollision;
+    friend class WorldT<T>;
+    friend class ParticleStoreT<T>;
+    friend class ConstraintT<T>;                    // for displace
+    template <typename> friend class ArenaAllocator;
+
+    typedef ParticleStoreT<T>   Store;
+    typedef ParticleStateT<T>   State;
+
+    // while the particle is in a world, its data lives in slot _slot of the world's packed store
+    // otherwise it lives in _state
+    Store           *_store;
+    long            _slot;
+    State           _state;
     bool            _isInited;
+    uint64_t        _springBatchMask;       // which of the world's spring batches this particle has springs in
+    vector< ConstraintT<T>* >   _constraints;   // kept up to date by the world
 
     ParticleT(const T& pos, float mass = 1.0f, float drag = 1.0f);
     ParticleT(ParticleT& p);
 
+    template <typename V>
+    V&              field(vector< V, AlignedAllocator<V> > Store::*a, V State::*s)              { return _store ? (_store->*a)[_slot] : _state.*s; }
+    template <typename V>
+    const V&        field(vector< V, AlignedAllocator<V> > Store::*a, V State::*s) const        { return _store ? (_store->*a)[_slot] : _state.*s; }
+
+    bool            hasFlag(unsigned int f) const   { return (field(&Store::flags, &State::flags) & f) != 0; }
+    void            setFlag(unsigned int f, bool b) { unsigned int &flags = field(&Store::flags, &State::flags); flags = b ? (flags | f) : (flags & ~f); }
+
+    // move the particle's data into a slot of the world's store, or back out of it
+    void            attach(Store *store)            { _slot = store->add(this, _state); _store = store; if(isDead()) store->killed.push_back(getHandle()); }
+    void            detach();
+    void            wake()                          { if(_store) _store->wake(_slot); }
+
+    // moveBy without returning a smart pointer to this (so without touching the reference count), for the solvers
+    void            displace(const T& offset, bool preserveVelocity);
+
     virtual void debugDraw();
 };
 
@@ -126,7 +174,11 @@ void ParticleT<T>::init(const T& pos, float mass, float drag) {
     //    _params = nullptr;
     //    _world = nullptr;
 
-    _pos = _oldPos = pos;
+    wake();
+    if(_store) _store->setPosition(_slot, pos);
+    else _state.pos = pos;
+    setOldPosition(pos);
+    field(&Store::flags, &State::flags) = 0;
     setMass(mass);
     setDrag(drag);
     setBounce();
@@ -134,19 +186,21 @@ void ParticleT<T>::init(const T& pos, float mass, float drag) {
     enableCollision();
     disablePassiveCollision();
     makeFree();
-    _isDead = false;
-    _age = 0;
+    field(&Store::age, &State::age) = 0;
+    setLifetime();
     data = NULL;
 
-    collisionPlane = -1;
+    setCollisionPlane(-1);
 }
 
 
 //--------------------------------------------------------------
 template <typename T>
 typename ParticleT<T>::Particle_ptr ParticleT<T>::setMass(float m) {
-    _mass = std::max(m, 0.00001f);    // can't remember why I did this, lazy way to avoid divide-by-zero later?
-    _invMass = _mass > 0 ? 1.0f/_mass : 0;
+    wake();
+    float &mass = field(&Store::mass, &State::mass);
+    mass = std::max(m, 0.00001f);    // can't remember why I did this, lazy way to avoid divide-by-zero later?
+    field(&Store::invMass, &State::invMass) = mass > 0 ? 1.0f/mass : 0;
     return getThis();
 }
 
@@ -224,10 +278,24 @@ typename ParticleT<T>::Particle_ptr ParticleT<T>::setMass(float m) {
 //    _oldPos = _pos; _isFixed = false; return getThis();
 //}
 
+//--------------------------------------------------------------
+template <typename T>
+void ParticleT<T>::detach() {
+    if(!_store) return;
+    if(isSleeping()) _store->numSleeping--;
+    _store->load(_slot, _state);
+    _store->releaseHandle(_slot);
+    _store = nullptr;
+    _slot = -1;
+
+    // sleeping only means something in a world
+    _state.flags &= ~(kParticleFlagSleeping | kParticleFlagWake | kParticleFlagTouched);
+}
+
 //--------------------------------------------------------------
 template <typename T>
 typename ParticleT<T>::Particle_ptr ParticleT<T>::moveTo(const T& targetPos, bool preserveVelocity) {
-    T diff(targetPos - _pos);
+    T diff(targetPos - getPosition());
     moveBy(diff, preserveVelocity);
     return getThis();
 }
@@ -235,15 +303,30 @@ typename ParticleT<T>::Particle_ptr ParticleT<T>::moveTo(const T& targetPos, boo
 //--------------------------------------------------------------
 template <typename T>
 typename ParticleT<T>::Particle_ptr ParticleT<T>::moveBy(const T& offset, bool preserveVelocity) {
-    _pos += offset;
-    if(preserveVelocity) _oldPos += offset;
+    displace(offset, preserveVelocity);
     return getThis();
 }
 
+//--------------------------------------------------------------
+template <typename T>
+void ParticleT<T>::displace(const T& offset, bool preserveVelocity) {
+    if(_store) {
+        if(isSleeping()) wake();    // (constraints move particles through here too, so awake ones aren't made to start counting again)
+        for(int d=0; d<T::DIM; d++) {
+            _store->pos[d][_slot] += offset[d];
+            if(preserveVelocity) _store->oldPos[d][_slot] += offset[d];
+        }
+    } else {
+        _state.pos += offset;
+        if(preserveVelocity) _state.oldPos += offset;
+    }
+}
+
 //--------------------------------------------------------------
 template <typename T>
 typename ParticleT<T>::Particle_ptr ParticleT<T>::setOldPosition(const T& p) {
-    _oldPos = p;
+    if(_store) _store->setOldPosition(_slot, p);
+    else _state.oldPos = p;
     return getThis();
 }
 
@@ -272,10 +355,15 @@ typename ParticleT<T>::Particle_ptr ParticleT<T>::setOldPosition(const T& p) {
 //}
 
 //--------------------------------------------------------------
-//template <typename T>
-//void ParticleT<T>::kill() {
-//    _isDead = true;
-//}
+template <typename T>
+void ParticleT<T>::kill() {
+    if(isDead()) return;
+    setFlag(kParticleFlagDead, true);
+
+    // queue it and its constraints for removal, so the world doesn't have to look for dead ones
+    if(_store) _store->killed.push_back(getHandle());
+    for(auto&& c : _constraints) c->queueRemoval();
+}
 
 
 //--------------------------------------------------------------
@@ -288,6 +376,9 @@ typename ParticleT<T>::Particle_ptr ParticleT<T>::setOldPosition(const T& p) {
 template <typename T>
 ParticleT<T>::ParticleT(const T& pos, float mass, float drag) {
     _isInited = false;
+    _store = nullptr;
+    _slot = -1;
+    _springBatchMask = 0;
     init(pos, mass, drag);
     _isInited = true;
 }
@@ -296,10 +387,14 @@ ParticleT<T>::ParticleT(const T& pos, float mass, float drag) {
 template <typename T>
 ParticleT<T>::ParticleT(ParticleT<T> &p) {
     _isInited = false;
-    init(p.getPosition(), p._mass, p._drag);
-    _isFixed = p._isFixed;
-    setBounce(p._bounce);
-    setRadius(p._radius);
+    _store = nullptr;
+    _slot = -1;
+    _springBatchMask = 0;
+
+    init(p.getPosition(), p.getMass(), p.getDrag());
+    setFlag(kParticleFlagFixed, p.isFixed());
+    setBounce(p.getBounce());
+    setRadius(p.getRadius());
     _isInited = true;
 }
 
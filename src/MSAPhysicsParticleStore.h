@@ -0,0 +1,328 @@
+#pragma once
+
+#include "MSACore.h"
+#include "MSAPhysicsTypes.h"
+#include "MSAPhysicsHandle.h"
+
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+
+// the spring solver and the collision narrow phase have SIMD versions, using AVX2 if it's enabled at compile time, otherwise SSE
+// define MSAPHYSICS_NO_SIMD to always use plain C++
+#if !defined(MSAPHYSICS_NO_SIMD) && (defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64))
+#include <immintrin.h>
+#define MSAPHYSICS_SIMD
+#endif
+
+
+namespace msa {
+namespace physics {
+
+// per particle boolean state, packed into one word per slot
+enum ParticleFlag {
+    kParticleFlagFixed              = 1 << 0,
+    kParticleFlagDead               = 1 << 1,
+    kParticleFlagCollision          = 1 << 2,
+    kParticleFlagPassiveCollision   = 1 << 3,
+    kParticleFlagSleeping           = 1 << 4,       // at rest, and skipped until something wakes it
+    kParticleFlagWake               = 1 << 5,       // a sleeper which has been pushed, to be woken after the parallel parts of the update
+    kParticleFlagTouched            = 1 << 6,       // a sleeper which something awake has touched, to be woken (but not made to start counting again)
+
+    kParticleFlagsImmobile          = kParticleFlagFixed | kParticleFlagSleeping,
+};
+
+
+// minimal aligned allocator so the packed arrays can be loaded straight into SIMD registers
+template <typename U, size_t Alignment = 32>
+struct AlignedAllocator {
+    typedef U value_type;
+    template <typename V> struct rebind { typedef AlignedAllocator<V, Alignment> other; };
+
+    AlignedAllocator() {}
+    template <typename V> AlignedAllocator(const AlignedAllocator<V, Alignment>&) {}
+
+    U* allocate(size_t n) {
+        void *raw = malloc(n * sizeof(U) + Alignment + sizeof(void*));
+        if(!raw) throw std::bad_alloc();
+        uintptr_t p = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + Alignment - 1) & ~(uintptr_t)(Alignment - 1);
+        reinterpret_cast<void**>(p)[-1] = raw;
+        return reinterpret_cast<U*>(p);
+    }
+
+    void deallocate(U* p, size_t) {
+        if(p) free(reinterpret_cast<void**>(p)[-1]);
+    }
+
+    template <typename V> bool operator==(const AlignedAllocator<V, Alignment>&) const { return true; }
+    template <typename V> bool operator!=(const AlignedAllocator<V, Alignment>&) const { return false; }
+};
+
+
+// the state of a single particle, used while a particle isn't owned by a world
+template <typename T>
+struct ParticleStateT {
+    T               pos;
+    T               oldPos;
+    float           mass, invMass;
+    float           drag;
+    float           bounce;
+    float           radius;
+    float           age;
+    float           lifetime;
+    unsigned int    flags;
+    unsigned int    collisionPlane;
+};
+
+
+// structure-of-arrays storage for all particles in a world
+// each particle owns a slot, and ParticleT is just a view onto that slot
+// all arrays are the same length, and slot i belongs to owner[i]
+template <typename T>
+class ParticleStoreT {
+public:
+    typedef vector< float, AlignedAllocator<float> >            FloatArray;
+    typedef vector< unsigned int, AlignedAllocator<unsigned int> >  UIntArray;
+
+    FloatArray              pos[T::DIM];        // one array per axis
+    FloatArray              oldPos[T::DIM];
+    FloatArray              settledPos[T::DIM]; // where the particle was at the end of the last update (for sleeping)
+    FloatArray              mass, invMass;
+    FloatArray              drag;
+    FloatArray              bounce;
+    FloatArray              radius;
+    FloatArray              age;
+    FloatArray              lifetime;           // 0 for particles which live forever
+    UIntArray               flags;
+    UIntArray               collisionPlane;
+    UIntArray               handleIndex;        // entry in handles
+    UIntArray               stillFrames;        // updates in a row the particle has hardly moved since the one before (for sleeping)
+    vector< ParticleT<T>* > owner;
+
+    // handles of the particles in the store, the value of each is its slot
+    HandleTableT< ParticleHandle, long >    handles;
+
+    // particles killed since the world last removed dead particles (some might have gone already)
+    vector< ParticleHandle >    killed;
+
+    long                    numSleeping;
+    float                   wakeDistance;       // how far a force has to push a sleeper to wake it
+
+    ParticleStoreT() : numSleeping(0), wakeDistance(0) {}
+
+    long    size() const                                { return owner.size(); }
+
+    void    reserve(long n);
+    void    resize(long n);
+    void    clear()                                     { resize(0); killed.clear(); numSleeping = 0; }
+
+    // append a slot for particle p, initialized from state s. returns slot index
+    long    add(ParticleT<T>* p, const ParticleStateT<T>& s);
+
+    ParticleHandle  getHandle(long i) const             { return handles.getHandle(handleIndex[i]); }
+    long    getSlot(const ParticleHandle& h) const      { return handles.get(h, -1); }
+
+    // invalidate the handle of a slot which is about to be removed
+    void    releaseHandle(long i)                       { handles.remove(getHandle(i)); }
+
+    // wake the island slot i is in: all sleepers joined to it through constraints, not counting paths through fixed particles
+    // (so waking a fixed particle wakes the islands hanging off it). if isStill, they carry on counting how long they've been still
+    void    wake(long i, bool isStill = false);
+
+    // copy slot to and from the unpacked representation
+    void    load(long i, ParticleStateT<T>& s) const;
+    void    store(long i, const ParticleStateT<T>& s);
+
+    // copy slot src into slot dst (and tell the owner it has moved)
+    void    moveSlot(long dst, long src);
+
+    // shuffle all slots so that new slot i holds what was in slot order[i]
+    void    reorder(const vector<long>& order);
+
+    T       getPosition(long i) const                   { T r; for(int d=0; d<T::DIM; d++) r[d] = pos[d][i]; return r; }
+    T       getOldPosition(long i) const                { T r; for(int d=0; d<T::DIM; d++) r[d] = oldPos[d][i]; return r; }
+    void    setPosition(long i, const T& p)             { for(int d=0; d<T::DIM; d++) pos[d][i] = p[d]; }
+    void    setOldPosition(long i, const T& p)          { for(int d=0; d<T::DIM; d++) oldPos[d][i] = p[d]; }
+
+protected:
+    // spare buffers for reorder, swapped with the real arrays so there are no allocations once they're big enough
+    FloatArray              _scratchFloat;
+    UIntArray               _scratchUInt;
+    vector< ParticleT<T>* > _scratchOwner;
+    vector< long >          _wakeStack;
+
+    template <typename A>
+    static void permute(A& a, A& scratch, const vector<long>& order) {
+        scratch.resize(a.size());
+        for(size_t i=0; i<order.size(); i++) scratch[i] = a[order[i]];
+        a.swap(scratch);
+    }
+};
+
+
+//--------------------------------------------------------------
+template <typename T>
+void ParticleStoreT<T>::reserve(long n) {
+    for(int d=0; d<T::DIM; d++) {
+        pos[d].reserve(n);
+        oldPos[d].reserve(n);
+        settledPos[d].reserve(n);
+    }
+    mass.reserve(n);
+    invMass.reserve(n);
+    drag.reserve(n);
+    bounce.reserve(n);
+    radius.reserve(n);
+    age.reserve(n);
+    lifetime.reserve(n);
+    flags.reserve(n);
+    collisionPlane.reserve(n);
+    handleIndex.reserve(n);
+    stillFrames.reserve(n);
+    owner.reserve(n);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void ParticleStoreT<T>::resize(long n) {
+    for(int d=0; d<T::DIM; d++) {
+        pos[d].resize(n);
+        oldPos[d].resize(n);
+        settledPos[d].resize(n);
+    }
+    mass.resize(n);
+    invMass.resize(n);
+    drag.resize(n);
+    bounce.resize(n);
+    radius.resize(n);
+    age.resize(n);
+    lifetime.resize(n);
+    flags.resize(n);
+    collisionPlane.resize(n);
+    handleIndex.resize(n);
+    stillFrames.resize(n);
+    owner.resize(n);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+long ParticleStoreT<T>::add(ParticleT<T>* p, const ParticleStateT<T>& s) {
+    long i = size();
+    resize(i + 1);
+    owner[i] = p;
+    handleIndex[i] = handles.add(i).index;
+    stillFrames[i] = 0;
+    store(i, s);
+    for(int d=0; d<T::DIM; d++) settledPos[d][i] = s.pos[d];
+    return i;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void ParticleStoreT<T>::load(long i, ParticleStateT<T>& s) const {
+    s.pos               = getPosition(i);
+    s.oldPos            = getOldPosition(i);
+    s.mass              = mass[i];
+    s.invMass           = invMass[i];
+    s.drag              = drag[i];
+    s.bounce            = bounce[i];
+    s.radius            = radius[i];
+    s.age               = age[i];
+    s.lifetime          = lifetime[i];
+    s.flags             = flags[i];
+    s.collisionPlane    = collisionPlane[i];
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void ParticleStoreT<T>::store(long i, const ParticleStateT<T>& s) {
+    setPosition(i, s.pos);
+    setOldPosition(i, s.oldPos);
+    mass[i]             = s.mass;
+    invMass[i]          = s.invMass;
+    drag[i]             = s.drag;
+    bounce[i]           = s.bounce;
+    radius[i]           = s.radius;
+    age[i]              = s.age;
+    lifetime[i]         = s.lifetime;
+    flags[i]            = s.flags;
+    collisionPlane[i]   = s.collisionPlane;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void ParticleStoreT<T>::moveSlot(long dst, long src) {
+    for(int d=0; d<T::DIM; d++) {
+        pos[d][dst]     = pos[d][src];
+        oldPos[d][dst]  = oldPos[d][src];
+        settledPos[d][dst] = settledPos[d][src];
+    }
+    mass[dst]           = mass[src];
+    invMass[dst]        = invMass[src];
+    drag[dst]           = drag[src];
+    bounce[dst]         = bounce[src];
+    radius[dst]         = radius[src];
+    age[dst]            = age[src];
+    lifetime[dst]       = lifetime[src];
+    flags[dst]          = flags[src];
+    collisionPlane[dst] = collisionPlane[src];
+    handleIndex[dst]    = handleIndex[src];
+    stillFrames[dst]    = stillFrames[src];
+    handles.set(handleIndex[dst], dst);
+    owner[dst]          = owner[src];
+    owner[dst]->_slot   = dst;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void ParticleStoreT<T>::reorder(const vector<long>& order) {
+    for(int d=0; d<T::DIM; d++) {
+        permute(pos[d], _scratchFloat, order);
+        permute(oldPos[d], _scratchFloat, order);
+        permute(settledPos[d], _scratchFloat, order);
+    }
+    permute(mass, _scratchFloat, order);
+    permute(invMass, _scratchFloat, order);
+    permute(drag, _scratchFloat, order);
+    permute(bounce, _scratchFloat, order);
+    permute(radius, _scratchFloat, order);
+    permute(age, _scratchFloat, order);
+    permute(lifetime, _scratchFloat, order);
+    permute(flags, _scratchUInt, order);
+    permute(collisionPlane, _scratchUInt, order);
+    permute(handleIndex, _scratchUInt, order);
+    permute(stillFrames, _scratchUInt, order);
+    permute(owner, _scratchOwner, order);
+    for(long i=0; i<size(); i++) {
+        owner[i]->_slot = i;
+        handles.set(handleIndex[i], i);
+    }
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void ParticleStoreT<T>::wake(long i, bool isStill) {
+    if(!isStill) stillFrames[i] = 0;
+    if(numSleeping == 0) return;
+
+    // the island is all asleep or all awake, so only sleepers need following
+    _wakeStack.clear();
+    _wakeStack.push_back(i);
+    while(!_wakeStack.empty()) {
+        long j = _wakeStack.back();
+        _wakeStack.pop_back();
+        if(flags[j] & kParticleFlagSleeping) numSleeping--;
+        flags[j] &= ~(kParticleFlagSleeping | kParticleFlagWake | kParticleFlagTouched);
+        if(!isStill) stillFrames[j] = 0;
+        if(j != i && (flags[j] & kParticleFlagFixed)) continue;
+
+        ParticleT<T> *p = owner[j];
+        for(auto&& c : p->_constraints) {
+            ParticleT<T> *other = c->getParticleA() == p ? c->getParticleB() : c->getParticleA();
+            if(other && other->_store == this && (flags[other->_slot] & kParticleFlagSleeping)) _wakeStack.push_back(other->_slot);
+        }
+    }
+}
+
+}
+}
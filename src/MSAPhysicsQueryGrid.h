@@ -0,0 +1,413 @@
+#pragma once
+
+#include "MSACore.h"
+#include "MSAPhysicsParticleStore.h"
+#include "MSAPhysicsTypes.h"
+
+namespace msa {
+namespace physics {
+
+// where a ray or segment hit a particle
+template <typename T>
+struct RayHitT {
+    long        index;          // of the particle (as in getParticle(i))
+    float       distance;       // along the ray from its origin (0 if the origin is inside the particle)
+    T           position;
+    T           normal;         // of the particle's surface at position
+};
+
+// a uniform grid of all live particles in a store, for spatial queries (radius, k nearest, box)
+// slots are sorted by cell, with a copy of their positions, so each cell is a contiguous run
+// queries test particle centres, and return slots (the same as particle indices in the world)
+template <typename T>
+class QueryGridT {
+public:
+    typedef vector< pair<float, long> >     Heap;
+
+    QueryGridT() : _cellSize(1), _maxRadius(0) { for(int d=0; d<T::DIM; d++) _dims[d] = 1; }
+
+    // cellSize 0 works it out from the number of particles and their spread
+    void            build(const ParticleStoreT<T>& store, float cellSize);
+
+    // the query functions clear out first. they only read the grid, so they can run on several threads at once
+    void            findInRadius(const T& pos, float radius, vector<long>& out) const;
+    void            findInBox(const T& boxMin, const T& boxMax, vector<long>& out) const;
+
+    // sorted nearest first. heap is scratch space, so repeated queries don't allocate
+    void            findNearest(const T& pos, int k, vector<long>& out, Heap& heap) const;
+
+    // particles (as spheres, or circles in 2D, of their radius) hit by the ray from origin along direction (normalised), up to maxDistance
+    // the ray walks the cells it passes through (a DDA), so only particles near it are tested
+    // if isFirstOnly only the nearest hit is found (and the walk stops as soon as it's known), otherwise all hits, sorted nearest first
+    void            castRay(const T& origin, const T& direction, float maxDistance, bool isFirstOnly, vector< RayHitT<T> >& hits) const;
+
+protected:
+    enum { kMaxCellsPerParticle = 4 };
+
+    T               _min;
+    float           _cellSize, _cellSizeInv;
+    int             _dims[T::DIM];
+    vector< long >  _cellStarts;            // start of each cell in _slots (one extra at the end)
+    vector< long >  _slots;
+    vector< float > _pos[T::DIM];           // positions in the same order as _slots
+    vector< float > _radius;
+    float           _maxRadius;
+    vector< long >  _cells;                 // scratch while building
+
+    int             getCoord(float p, int d) const;
+    long            getCellIndex(const int *coords) const;
+
+    // call f(k) for every entry k in cells [lo, hi] on every axis, except those in cells [holeLo, holeHi] (if given)
+    template <typename F>
+    void            forEachInCells(const int *lo, const int *hi, F f, const int *holeLo = nullptr, const int *holeHi = nullptr) const;
+};
+
+
+//--------------------------------------------------------------
+template <typename T>
+int QueryGridT<T>::getCoord(float p, int d) const {
+    // (clamped before converting to int, so it can't overflow)
+    float c = floor((p - _min[d]) * _cellSizeInv);
+    return c < 0 ? 0 : (c >= _dims[d] ? _dims[d] - 1 : (int)c);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+long QueryGridT<T>::getCellIndex(const int *coords) const {
+    long index = 0;
+    for(int d=T::DIM-1; d>=0; d--) index = index * _dims[d] + coords[d];
+    return index;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void QueryGridT<T>::build(const ParticleStoreT<T>& store, float cellSize) {
+    long n = 0;
+    T maxPos;
+    float totalRadius = 0;
+    for(int d=0; d<T::DIM; d++) {
+        _min[d] = FLT_MAX;
+        maxPos[d] = -FLT_MAX;
+    }
+    for(long i=0; i<store.size(); i++) {
+        if(store.flags[i] & kParticleFlagDead) continue;
+        for(int d=0; d<T::DIM; d++) {
+            _min[d] = std::min(_min[d], store.pos[d][i]);
+            maxPos[d] = std::max(maxPos[d], store.pos[d][i]);
+        }
+        totalRadius += store.radius[i];
+        n++;
+    }
+    if(n == 0) for(int d=0; d<T::DIM; d++) _min[d] = maxPos[d] = 0;
+
+    // about one particle per cell, but no smaller than the average particle
+    if(cellSize <= 0) {
+        float volume = 1;
+        for(int d=0; d<T::DIM; d++) volume *= std::max(maxPos[d] - _min[d], FLT_EPSILON);
+        cellSize = std::max(pow(volume / std::max(n, 1L), 1.0f / T::DIM), 2 * totalRadius / std::max(n, 1L));
+    }
+
+    // and big enough next to the coordinates that stepping from cell to cell doesn't get lost in rounding
+    float maxCoord = 0;
+    for(int d=0; d<T::DIM; d++) maxCoord = std::max(maxCoord, std::max(fabsf(_min[d]), fabsf(maxPos[d])));
+    cellSize = std::max(cellSize, 1e-5f * (1 + maxCoord));
+
+    // but never many more cells than particles (e.g. when they're all spread along one axis)
+    double maxCells = (double)kMaxCellsPerParticle * n + 64;
+    while(true) {
+        double numCells = 1;
+        for(int d=0; d<T::DIM; d++) numCells *= floor((maxPos[d] - _min[d]) / cellSize) + 1;
+        if(numCells <= maxCells) break;
+        cellSize *= 2;
+    }
+    _cellSize = cellSize;
+    _cellSizeInv = 1.0f / cellSize;
+    long numCells = 1;
+    for(int d=0; d<T::DIM; d++) {
+        _dims[d] = (int)floor((maxPos[d] - _min[d]) * _cellSizeInv) + 1;
+        numCells *= _dims[d];
+    }
+
+    // counting sort of the slots by cell
+    _cells.resize(store.size());
+    _cellStarts.assign(numCells + 1, 0);
+    for(long i=0; i<store.size(); i++) {
+        if(store.flags[i] & kParticleFlagDead) {
+            _cells[i] = -1;
+            continue;
+        }
+        int coords[T::DIM];
+        for(int d=0; d<T::DIM; d++) coords[d] = getCoord(store.pos[d][i], d);
+        _cells[i] = getCellIndex(coords);
+        _cellStarts[_cells[i] + 1]++;
+    }
+    for(long c=0; c<numCells; c++) _cellStarts[c + 1] += _cellStarts[c];
+
+    _slots.resize(n);
+    for(int d=0; d<T::DIM; d++) _pos[d].resize(n);
+    _radius.resize(n);
+    _maxRadius = 0;
+    for(long i=0; i<store.size(); i++) {
+        if(_cells[i] < 0) continue;
+        long k = _cellStarts[_cells[i]]++;
+        _slots[k] = i;
+        for(int d=0; d<T::DIM; d++) _pos[d][k] = store.pos[d][i];
+        _radius[k] = store.radius[i];
+        _maxRadius = std::max(_maxRadius, store.radius[i]);
+    }
+
+    // (the scatter moved each start along to the next one)
+    for(long c=numCells; c>0; c--) _cellStarts[c] = _cellStarts[c - 1];
+    _cellStarts[0] = 0;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+template <typename F>
+void QueryGridT<T>::forEachInCells(const int *lo, const int *hi, F f, const int *holeLo, const int *holeHi) const {
+    // walk the rows along axis 0, which are contiguous
+    int coords[T::DIM];
+    for(int d=0; d<T::DIM; d++) coords[d] = lo[d];
+    while(true) {
+        long rowStart = getCellIndex(coords);
+        long begin = _cellStarts[rowStart];
+        long end = _cellStarts[rowStart + hi[0] - lo[0] + 1];
+
+        // rows through the hole are split in two around it
+        bool isRowInHole = holeLo != nullptr;
+        for(int d=1; d<T::DIM && isRowInHole; d++) isRowInHole = coords[d] >= holeLo[d] && coords[d] <= holeHi[d];
+        if(isRowInHole) {
+            long holeBegin = _cellStarts[rowStart + holeLo[0] - lo[0]];
+            long holeEnd = _cellStarts[rowStart + holeHi[0] - lo[0] + 1];
+            for(long k=begin; k<holeBegin; k++) f(k);
+            for(long k=holeEnd; k<end; k++) f(k);
+        } else {
+            for(long k=begin; k<end; k++) f(k);
+        }
+
+        int d = 1;
+        for(; d<T::DIM; d++) {
+            if(++coords[d] <= hi[d]) break;
+            coords[d] = lo[d];
+        }
+        if(d == T::DIM) break;
+    }
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void QueryGridT<T>::findInRadius(const T& pos, float radius, vector<long>& out) const {
+    out.clear();
+    if(_slots.empty() || radius < 0) return;
+
+    int lo[T::DIM], hi[T::DIM];
+    for(int d=0; d<T::DIM; d++) {
+        lo[d] = getCoord(pos[d] - radius, d);
+        hi[d] = getCoord(pos[d] + radius, d);
+    }
+
+    float radius2 = radius * radius;
+    forEachInCells(lo, hi, [&](long k) {
+        float distance2 = 0;
+        for(int d=0; d<T::DIM; d++) {
+            float delta = _pos[d][k] - pos[d];
+            distance2 += delta * delta;
+        }
+        if(distance2 <= radius2) out.push_back(_slots[k]);
+    });
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void QueryGridT<T>::findInBox(const T& boxMin, const T& boxMax, vector<long>& out) const {
+    out.clear();
+    if(_slots.empty()) return;
+
+    int lo[T::DIM], hi[T::DIM];
+    for(int d=0; d<T::DIM; d++) {
+        if(boxMax[d] < boxMin[d]) return;
+        lo[d] = getCoord(boxMin[d], d);
+        hi[d] = getCoord(boxMax[d], d);
+    }
+
+    forEachInCells(lo, hi, [&](long k) {
+        for(int d=0; d<T::DIM; d++) if(_pos[d][k] < boxMin[d] || _pos[d][k] > boxMax[d]) return;
+        out.push_back(_slots[k]);
+    });
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void QueryGridT<T>::findNearest(const T& pos, int k, vector<long>& out, Heap& heap) const {
+    out.clear();
+    heap.clear();
+    if(_slots.empty() || k <= 0) return;
+
+    // search growing shells of cells around pos, keeping the k nearest so far in a max heap
+    // until the nearest unsearched cell is further away than the kth nearest
+    int centre[T::DIM];
+    for(int d=0; d<T::DIM; d++) centre[d] = getCoord(pos[d], d);
+
+    int lo[T::DIM], hi[T::DIM], prevLo[T::DIM], prevHi[T::DIM];
+    for(int ring=0; ; ring++) {
+        bool coversGrid = true;
+        for(int d=0; d<T::DIM; d++) {
+            lo[d] = std::max(centre[d] - ring, 0);
+            hi[d] = std::min(centre[d] + ring, _dims[d] - 1);
+            if(lo[d] > 0 || hi[d] < _dims[d] - 1) coversGrid = false;
+        }
+
+        // (only the new shell, the block inside it was searched in the previous ring)
+        forEachInCells(lo, hi, [&](long e) {
+            float distance2 = 0;
+            for(int d=0; d<T::DIM; d++) {
+                float delta = _pos[d][e] - pos[d];
+                distance2 += delta * delta;
+            }
+            if((int)heap.size() < k) {
+                heap.push_back(make_pair(distance2, _slots[e]));
+                push_heap(heap.begin(), heap.end());
+            } else if(distance2 < heap.front().first) {
+                pop_heap(heap.begin(), heap.end());
+                heap.back() = make_pair(distance2, _slots[e]);
+                push_heap(heap.begin(), heap.end());
+            }
+        }, ring > 0 ? prevLo : nullptr, prevHi);
+
+        if(coversGrid) break;
+
+        // distance from pos to the nearest cell outside the searched block
+        if((int)heap.size() == k) {
+            float gap = FLT_MAX;
+            for(int d=0; d<T::DIM; d++) {
+                if(lo[d] > 0) gap = std::min(gap, pos[d] - (_min[d] + lo[d] * _cellSize));
+                if(hi[d] < _dims[d] - 1) gap = std::min(gap, _min[d] + (hi[d] + 1) * _cellSize - pos[d]);
+            }
+            if(gap > 0 && gap * gap >= heap.front().first) break;
+        }
+
+        for(int d=0; d<T::DIM; d++) {
+            prevLo[d] = lo[d];
+            prevHi[d] = hi[d];
+        }
+    }
+
+    sort_heap(heap.begin(), heap.end());
+    for(auto&& h : heap) out.push_back(h.second);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void QueryGridT<T>::castRay(const T& origin, const T& direction, float maxDistance, bool isFirstOnly, vector< RayHitT<T> >& hits) const {
+    hits.clear();
+    if(_slots.empty() || maxDistance < 0) return;
+
+    // a particle can reach up to pad cells out of the cell its centre is in
+    // so each cell the ray passes through is tested along with the cells up to pad away
+    int pad = (int)ceil(_maxRadius * _cellSizeInv);
+
+    // clip the ray to the grid, grown by pad cells
+    float tEnter = 0, tExit = maxDistance;
+    for(int d=0; d<T::DIM; d++) {
+        float lo = _min[d] - pad * _cellSize;
+        float hi = _min[d] + (_dims[d] + pad) * _cellSize;
+        if(direction[d] == 0) {
+            if(origin[d] < lo || origin[d] > hi) return;
+            continue;
+        }
+        float t0 = (lo - origin[d]) / direction[d];
+        float t1 = (hi - origin[d]) / direction[d];
+        if(t0 > t1) swap(t0, t1);
+        tEnter = std::max(tEnter, t0);
+        tExit = std::min(tExit, t1);
+    }
+    if(tEnter > tExit) return;
+
+    // the cell the clipped ray starts in, and where it crosses into the next cell on each axis
+    int cell[T::DIM], step[T::DIM];
+    float tNext[T::DIM], tDelta[T::DIM];
+    for(int d=0; d<T::DIM; d++) {
+        float c = floor((origin[d] + direction[d] * tEnter - _min[d]) * _cellSizeInv);
+        cell[d] = (int)std::min(std::max(c, (float)-pad), (float)(_dims[d] + pad - 1));
+        if(direction[d] > 0) {
+            step[d] = 1;
+            tNext[d] = (_min[d] + (cell[d] + 1) * _cellSize - origin[d]) / direction[d];
+            tDelta[d] = _cellSize / direction[d];
+        } else if(direction[d] < 0) {
+            step[d] = -1;
+            tNext[d] = (_min[d] + cell[d] * _cellSize - origin[d]) / direction[d];
+            tDelta[d] = -_cellSize / direction[d];
+        } else {
+            step[d] = 0;
+            tNext[d] = tDelta[d] = FLT_MAX;
+        }
+    }
+
+    // (can't cross more cells than this, whatever rounding does)
+    long maxSteps = 1;
+    for(int d=0; d<T::DIM; d++) maxSteps += _dims[d] + 2 * pad + 1;
+
+    float nearest = FLT_MAX;
+    float t = tEnter;
+    for(long s=0; s<maxSteps; s++) {
+        // any hit nearer than where this cell starts has been found already
+        if(isFirstOnly && nearest < t) break;
+
+        int lo[T::DIM], hi[T::DIM];
+        bool isOutside = false;
+        for(int d=0; d<T::DIM; d++) {
+            lo[d] = std::max(cell[d] - pad, 0);
+            hi[d] = std::min(cell[d] + pad, _dims[d] - 1);
+            if(lo[d] > hi[d]) isOutside = true;
+        }
+
+        if(!isOutside) forEachInCells(lo, hi, [&](long k) {
+            float b = 0;
+            float c = -_radius[k] * _radius[k];
+            for(int d=0; d<T::DIM; d++) {
+                float m = origin[d] - _pos[d][k];
+                b += m * direction[d];
+                c += m * m;
+            }
+            if(c > 0 && b > 0) return;          // outside, and pointing away
+            float discriminant = b * b - c;
+            if(discriminant < 0) return;
+
+            float distance = std::max(-b - sqrt(discriminant), 0.0f);
+            if(distance > maxDistance || (isFirstOnly && distance >= nearest)) return;
+            if(isFirstOnly) {
+                hits.clear();
+                nearest = distance;
+            }
+
+            RayHitT<T> hit;
+            hit.index = _slots[k];
+            hit.distance = distance;
+            hit.position = origin + direction * distance;
+            float normalLength2 = 0;
+            for(int d=0; d<T::DIM; d++) {
+                hit.normal[d] = hit.position[d] - _pos[d][k];
+                normalLength2 += hit.normal[d] * hit.normal[d];
+            }
+            hit.normal = normalLength2 > 0 ? hit.normal / sqrt(normalLength2) : -direction;
+            hits.push_back(hit);
+        });
+
+        // step into the next cell
+        int axis = 0;
+        for(int d=1; d<T::DIM; d++) if(tNext[d] < tNext[axis]) axis = d;
+        if(tNext[axis] > tExit) break;
+        t = tNext[axis];
+        cell[axis] += step[axis];
+        tNext[axis] += tDelta[axis];
+    }
+
+    // particles near several of the cells were tested more than once
+    if(!isFirstOnly) {
+        sort(hits.begin(), hits.end(), [](const RayHitT<T>& a, const RayHitT<T>& b) { return a.distance < b.distance || (a.distance == b.distance && a.index < b.index); });
+        hits.erase(unique(hits.begin(), hits.end(), [](const RayHitT<T>& a, const RayHitT<T>& b) { return a.index == b.index; }), hits.end());
+    }
+}
+
+}
+}
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "MSAPhysicsParticle.h"
+#include "MSAPhysicsParticleStore.h"
 #include "MSAPhysicsTypes.h"
 
 namespace msa {
 namespace physics {
 
+// a sector is a range of slots in the world's particle store
+// the world sorts particles by sector every frame, so all particles in a sector are contiguous
 template <typename T>
 class SectorT {
 public:
@@ -17,28 +20,67 @@ public:
     typedef shared_ptr< AttractionT<T> >      Attraction_ptr;
     typedef shared_ptr< ConstraintT<T> >      Constraint_ptr;
 
-    static Sector_ptr   create()                        { return Sector_ptr(new SectorT<T>); }
+    SectorT() : _begin(0), _end(0), _isAsleep(false) {}
 
-    void                checkSectorCollisions();
-    void                addParticle(Particle_ptr p)     { _particles.push_back(p); }
-    void                clear()                         { _particles.clear(); }
+    // check particles in this sector against each other
+    void                checkSectorCollisions(ParticleStoreT<T>& store) const      { forEachTouchingPair(store, [&store](long a, long b) { checkCollisionBetween(store, a, b); }); }
+
+    // check particles in this sector against particles in a neighbouring sector
+    void                checkCollisionsWith(ParticleStoreT<T>& store, const SectorT<T>& other) const   { forEachTouchingPairWith(store, other, [&store](long a, long b) { checkCollisionBetween(store, a, b); }); }
+
+    // call f(a, b) with the slots of every pair of particles in this sector, or between this sector and other
+    template <typename F> void  forEachPair(F f) const;
+    template <typename F> void  forEachPairWith(const SectorT<T>& other, F f) const;
+
+    // same, but only for pairs which are touching (and can collide with each other). several pairs are tested at once with SIMD
+    // f should resolve the collision, the pairs after it are tested with where it moved the particles to
+    template <typename F> void  forEachTouchingPair(const ParticleStoreT<T>& store, F f) const;
+    template <typename F> void  forEachTouchingPairWith(const ParticleStoreT<T>& store, const SectorT<T>& other, F f) const;
+
+    // narrow phase collision test and response between two particle slots
+    static bool         checkCollisionBetween(ParticleStoreT<T>& store, long a, long b);
+
+    // narrow phase test only
+    static bool         isTouching(const ParticleStoreT<T>& store, long a, long b);
+
+    // same, but without calling the particles' callbacks. the force applied to a is returned in deltaForce (b gets -deltaForce)
+    static bool         resolveCollisionBetween(ParticleStoreT<T>& store, long a, long b, T& deltaForce);
+
+    void                setRange(long begin, long end)  { _begin = begin; _end = end; }
+    long                begin() const                   { return _begin; }
+    long                end() const                     { return _end; }
+    bool                empty() const                   { return _begin == _end; }
+
+    // all particles in the sector are sleeping (set by the world when it sorts particles into sectors)
+    void                setAsleep(bool b)               { _isAsleep = b; }
+    bool                isAsleep() const                { return _isAsleep; }
 
 protected:
-    vector< Particle_ptr >	_particles;
+    long                _begin, _end;
+    bool                _isAsleep;
+
+    // call f(a, b) for each slot b in [begin, end) touching slot a
+    template <typename F> static void forEachTouching(const ParticleStoreT<T>& store, long a, long begin, long end, F f);
 
-    SectorT() {}
-    static bool checkCollisionBetween(ParticleT<T>& a, ParticleT<T>& b);
+#ifdef MSAPHYSICS_SIMD
+#ifdef __AVX2__
+    enum { kSimdWidth = 8 };
+#else
+    enum { kSimdWidth = 4 };
+#endif
+    // bit j is set if slot a is touching slot b + j
+    static int          touchingMask(const ParticleStoreT<T>& store, long a, long b);
+#endif
 };
 
 
 //--------------------------------------------------------------
 template <typename T>
-void SectorT<T>::checkSectorCollisions() {
-    int s = _particles.size();
-    for(int i=0; i<s-1; i++) {
-        auto& part1 = *_particles[i];
-        for(int j=i+1; j<s; j++) {
-            checkCollisionBetween(part1, *_particles[j]);
+template <typename F>
+void SectorT<T>::forEachPair(F f) const {
+    for(long i=_begin; i<_end-1; i++) {
+        for(long j=i+1; j<_end; j++) {
+            f(i, j);
         }
     }
 }
@@ -46,32 +88,171 @@ void SectorT<T>::checkSectorCollisions() {
 
 //--------------------------------------------------------------
 template <typename T>
-bool SectorT<T>::checkCollisionBetween(ParticleT<T>& a, ParticleT<T>& b) {
-    if(a.hasCollision() == false || b.hasCollision() == false) return false;
-    if(a.hasPassiveCollision() && b.hasPassiveCollision()) return false;
-    if((a.collisionPlane & b.collisionPlane) == 0) return false;
+template <typename F>
+void SectorT<T>::forEachPairWith(const SectorT<T>& other, F f) const {
+    for(long i=_begin; i<_end; i++) {
+        for(long j=other._begin; j<other._end; j++) {
+            f(i, j);
+        }
+    }
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+template <typename F>
+void SectorT<T>::forEachTouchingPair(const ParticleStoreT<T>& store, F f) const {
+    for(long i=_begin; i<_end-1; i++) forEachTouching(store, i, i+1, _end, f);
+}
+
 
-    //			printf("same planes %i %i\n", a.collisionPlane, b.collisionPlane);
+//--------------------------------------------------------------
+template <typename T>
+template <typename F>
+void SectorT<T>::forEachTouchingPairWith(const ParticleStoreT<T>& store, const SectorT<T>& other, F f) const {
+    for(long i=_begin; i<_end; i++) forEachTouching(store, i, other._begin, other._end, f);
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+template <typename F>
+void SectorT<T>::forEachTouching(const ParticleStoreT<T>& store, long a, long begin, long end, F f) {
+    long b = begin;
+#ifdef MSAPHYSICS_SIMD
+    while(b + kSimdWidth <= end) {
+        int mask = touchingMask(store, a, b);
+        if(mask == 0) {
+            b += kSimdWidth;
+            continue;
+        }
+
+        // resolving the collision moves a, so carry on testing from the slot after the hit
+        int j = 0;
+        while(((mask >> j) & 1) == 0) j++;
+        f(a, b + j);
+        b += j + 1;
+    }
+#endif
+    for(; b<end; b++) if(isTouching(store, a, b)) f(a, b);
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+bool SectorT<T>::isTouching(const ParticleStoreT<T>& store, long a, long b) {
+    unsigned int flagsA = store.flags[a];
+    unsigned int flagsB = store.flags[b];
+    if((flagsA & flagsB & kParticleFlagCollision) == 0) return false;
+    if(flagsA & flagsB & (kParticleFlagPassiveCollision | kParticleFlagSleeping)) return false;
+    if((store.collisionPlane[a] & store.collisionPlane[b]) == 0) return false;
+
+    float restLength = store.radius[b] + store.radius[a];
+    T delta = store.getPosition(b) - store.getPosition(a);
+    return delta.lengthSquared() <= restLength * restLength;
+}
 
-    float restLength = b.getRadius() + a.getRadius();
-    T delta = b.getPosition() - a.getPosition();
+
+#ifdef MSAPHYSICS_SIMD
+#ifdef __AVX2__
+
+//--------------------------------------------------------------
+template <typename T>
+int SectorT<T>::touchingMask(const ParticleStoreT<T>& store, long a, long b) {
+    // the same tests as isTouching, for 8 slots at once
+    __m256i flagsAB = _mm256_and_si256(_mm256_set1_epi32(store.flags[a]), _mm256_loadu_si256((const __m256i*)&store.flags[b]));
+    __m256i planesAB = _mm256_and_si256(_mm256_set1_epi32(store.collisionPlane[a]), _mm256_loadu_si256((const __m256i*)&store.collisionPlane[b]));
+    __m256i zero = _mm256_setzero_si256();
+    __m256i rejected = _mm256_or_si256(_mm256_or_si256(
+                            _mm256_cmpeq_epi32(_mm256_and_si256(flagsAB, _mm256_set1_epi32(kParticleFlagCollision)), zero),
+                            _mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_and_si256(flagsAB, _mm256_set1_epi32(kParticleFlagPassiveCollision | kParticleFlagSleeping)), zero), _mm256_set1_epi32(-1))),
+                            _mm256_cmpeq_epi32(planesAB, zero));
+
+    __m256 deltaLength2 = _mm256_setzero_ps();
+    for(int d=0; d<T::DIM; d++) {
+        __m256 delta = _mm256_sub_ps(_mm256_loadu_ps(&store.pos[d][b]), _mm256_set1_ps(store.pos[d][a]));
+        deltaLength2 = _mm256_add_ps(deltaLength2, _mm256_mul_ps(delta, delta));
+    }
+    __m256 restLength = _mm256_add_ps(_mm256_loadu_ps(&store.radius[b]), _mm256_set1_ps(store.radius[a]));
+    __m256 touching = _mm256_cmp_ps(deltaLength2, _mm256_mul_ps(restLength, restLength), _CMP_LE_OQ);
+
+    return _mm256_movemask_ps(_mm256_andnot_ps(_mm256_castsi256_ps(rejected), touching));
+}
+
+#else
+
+//--------------------------------------------------------------
+template <typename T>
+int SectorT<T>::touchingMask(const ParticleStoreT<T>& store, long a, long b) {
+    // the same tests as isTouching, for 4 slots at once
+    __m128i flagsAB = _mm_and_si128(_mm_set1_epi32(store.flags[a]), _mm_loadu_si128((const __m128i*)&store.flags[b]));
+    __m128i planesAB = _mm_and_si128(_mm_set1_epi32(store.collisionPlane[a]), _mm_loadu_si128((const __m128i*)&store.collisionPlane[b]));
+    __m128i zero = _mm_setzero_si128();
+    __m128i rejected = _mm_or_si128(_mm_or_si128(
+                            _mm_cmpeq_epi32(_mm_and_si128(flagsAB, _mm_set1_epi32(kParticleFlagCollision)), zero),
+                            _mm_xor_si128(_mm_cmpeq_epi32(_mm_and_si128(flagsAB, _mm_set1_epi32(kParticleFlagPassiveCollision | kParticleFlagSleeping)), zero), _mm_set1_epi32(-1))),
+                            _mm_cmpeq_epi32(planesAB, zero));
+
+    __m128 deltaLength2 = _mm_setzero_ps();
+    for(int d=0; d<T::DIM; d++) {
+        __m128 delta = _mm_sub_ps(_mm_loadu_ps(&store.pos[d][b]), _mm_set1_ps(store.pos[d][a]));
+        deltaLength2 = _mm_add_ps(deltaLength2, _mm_mul_ps(delta, delta));
+    }
+    __m128 restLength = _mm_add_ps(_mm_loadu_ps(&store.radius[b]), _mm_set1_ps(store.radius[a]));
+    __m128 touching = _mm_cmple_ps(deltaLength2, _mm_mul_ps(restLength, restLength));
+
+    return _mm_movemask_ps(_mm_andnot_ps(_mm_castsi128_ps(rejected), touching));
+}
+
+#endif
+#endif
+
+
+//--------------------------------------------------------------
+template <typename T>
+bool SectorT<T>::checkCollisionBetween(ParticleStoreT<T>& store, long a, long b) {
+    T deltaForce;
+    if(!resolveCollisionBetween(store, a, b, deltaForce)) return false;
+
+    store.owner[a]->collidedWithParticle(*store.owner[b], deltaForce);
+    store.owner[b]->collidedWithParticle(*store.owner[a], -deltaForce);
+
+    return true;
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+bool SectorT<T>::resolveCollisionBetween(ParticleStoreT<T>& store, long a, long b, T& deltaForce) {
+    if(!isTouching(store, a, b)) return false;
+
+    unsigned int flagsA = store.flags[a];
+    unsigned int flagsB = store.flags[b];
+    float restLength = store.radius[b] + store.radius[a];
+    T delta = store.getPosition(b) - store.getPosition(a);
     float deltaLength2 = delta.lengthSquared();
-    if(deltaLength2 >restLength * restLength) return false;
+
+    // a sleeper doesn't budge during collisions, but it's woken after them if something awake touches it
+    // (without resetting how long it's been still, so a particle coming to rest on a sleeping pile sends the whole lot back to sleep with it)
+    float invMassA = (flagsA & kParticleFlagSleeping) ? 0 : store.invMass[a];
+    float invMassB = (flagsB & kParticleFlagSleeping) ? 0 : store.invMass[b];
 
     // TODO: fast approximation of square root
     // (1st order Taylor-expansion at a neighborhood of the rest length r (one Newton-Raphson iteration with initial guess r))
     float deltaLength = sqrt(deltaLength2);
-    float force = (deltaLength - restLength) / (deltaLength * (a.getInvMass() + b.getInvMass()));
-
-    T deltaForce(delta * force);
+    if((flagsA | flagsB) & kParticleFlagSleeping) {
+        if(invMassA + invMassB <= 0) return false;
+        store.flags[(flagsA & kParticleFlagSleeping) ? a : b] |= kParticleFlagTouched;
+    }
+    float force = (deltaLength - restLength) / (deltaLength * (invMassA + invMassB));
 
-    if (a.isFree()) a.moveBy(deltaForce * a.getInvMass(), false);
-    if (b.isFree()) b.moveBy(deltaForce * -b.getInvMass(), false);
+    deltaForce = delta * force;
 
-    a.collidedWithParticle(b, deltaForce);
-    b.collidedWithParticle(a, -deltaForce);
+    if ((flagsA & kParticleFlagsImmobile) == 0) store.setPosition(a, store.getPosition(a) + deltaForce * invMassA);
+    if ((flagsB & kParticleFlagsImmobile) == 0) store.setPosition(b, store.getPosition(b) + deltaForce * -invMassB);
 
     return true;
+
 }
 
 }
@@ -18,12 +18,20 @@ public:
     typedef shared_ptr< AttractionT<T> >      Attraction_ptr;
     typedef shared_ptr< ConstraintT<T> >      Constraint_ptr;
 
+    friend class WorldT<T>;
+    template <typename> friend class ArenaAllocator;
+
     // create an instance of this class and return a smart pointer
     // this is the only way to instantiate this class
     static Spring_ptr create(Particle_ptr a, Particle_ptr b, float strength, float restLength) {
         return Spring_ptr(new SpringT<T>(a, b, strength, restLength));
     }
 
+    // the same, in an arena (see WorldT::getAllocator)
+    static Spring_ptr create(const ArenaAllocator< SpringT<T> >& alloc, Particle_ptr a, Particle_ptr b, float strength, float restLength) {
+        return allocate_shared< SpringT<T> >(alloc, a, b, strength, restLength);
+    }
+
     Spring_ptr          setStrength(float s)            { _strength = s; return getThis(); }
     float               getStrength() const             { return _strength; }
 
@@ -36,15 +44,17 @@ public:
     Spring_ptr          getThis()                       { return _isInited ? dynamic_pointer_cast< SpringT<T> >(this->shared_from_this()) : Spring_ptr(); }
 
     void solve() override {
-        T delta = this->_b->getPosition() - this->_a->getPosition();
+        ParticleT<T> *a = this->getParticleA();
+        ParticleT<T> *b = this->getParticleB();
+        T delta = b->getPosition() - a->getPosition();
         float deltaLength2 = delta.lengthSquared();
         float deltaLength = sqrt(deltaLength2);	// TODO: fast approximation of square root (1st order Taylor-expansion at a neighborhood of the rest length r (one Newton-Raphson iteration with initial guess r))
-        float force = deltaLength > 0 ? _strength * (deltaLength - _restLength) / (deltaLength * (this->_a->getInvMass() + this->_b->getInvMass())) : 0;
+        float force = deltaLength > 0 ? _strength * (deltaLength - _restLength) / (deltaLength * (a->getInvMass() + b->getInvMass())) : 0;
 
         T deltaForce(delta * force);
         if (_forceCap > 0) deltaForce.limit(_forceCap);
-        if (this->_a->isFree()) this->_a->moveBy(deltaForce * this->_a->getInvMass(), false);
-        if (this->_b->isFree()) this->_b->moveBy(deltaForce * -this->_b->getInvMass(), false);
+        if (a->isFree()) this->moveParticle(a, deltaForce * a->getInvMass());
+        if (b->isFree()) this->moveParticle(b, deltaForce * -b->getInvMass());
     }
 
 protected:
@@ -53,11 +63,16 @@ protected:
     float _forceCap;
     bool _isInited;
 
+    // where the world keeps it in its spring batches (-1 if it isn't in one)
+    int _batch;
+    long _batchIndex;
 
     SpringT(Particle_ptr a, Particle_ptr b, float strength, float restLength):
         ConstraintT<T>(a, b, kConstraintTypeSpring)
     {
         _isInited = false;
+        _batch = -1;
+        _batchIndex = -1;
         setStrength(strength);
         setRestLength(restLength);
         setForceCap(0);
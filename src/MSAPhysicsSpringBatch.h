@@ -0,0 +1,217 @@
+#pragma once
+
+#include "MSACore.h"
+#include "MSAPhysicsParticleStore.h"
+#include "MSAPhysicsTypes.h"
+
+namespace msa {
+namespace physics {
+
+// a batch of springs packed into flat arrays of particle slots and constants, so they can be solved several at a time with SIMD
+// no two springs in a batch may share a particle, so they can be solved in any order, or all at once
+// the world packs its springs into batches every frame (particles change slots when they are sorted)
+template <typename T>
+class SpringBatchT {
+public:
+    typedef typename ParticleStoreT<T>::FloatArray              FloatArray;
+    typedef vector< int, AlignedAllocator<int> >                IntArray;
+
+    IntArray            a, b;                   // particle slots
+    FloatArray          restLength;
+    FloatArray          stiffness;              // strength / (invMassA + invMassB)
+    FloatArray          weightA, weightB;       // inverse mass, or 0 if the particle is fixed
+    FloatArray          forceCap;               // 0 for no cap
+
+    long                size() const            { return a.size(); }
+    void                clear();
+    void                add(int slotA, int slotB, float rest, float strength, float invMassA, float invMassB, bool isFreeA, bool isFreeB, float cap);
+
+    // solve springs [begin, end) once
+    void                solve(ParticleStoreT<T>& store, long begin, long end) const;
+
+protected:
+    void                solveScalar(ParticleStoreT<T>& store, long begin, long end) const;
+
+#ifdef MSAPHYSICS_SIMD
+#ifdef __AVX2__
+    enum { kSimdWidth = 8 };
+#else
+    enum { kSimdWidth = 4 };
+#endif
+    // solve one group of kSimdWidth springs, only writing back the first n
+    static void         solveGroup(ParticleStoreT<T>& store, const int *ia, const int *ib, const float *rest, const float *k, const float *wa, const float *wb, const float *cap, int n);
+#endif
+};
+
+
+//--------------------------------------------------------------
+template <typename T>
+void SpringBatchT<T>::clear() {
+    a.clear();
+    b.clear();
+    restLength.clear();
+    stiffness.clear();
+    weightA.clear();
+    weightB.clear();
+    forceCap.clear();
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void SpringBatchT<T>::add(int slotA, int slotB, float rest, float strength, float invMassA, float invMassB, bool isFreeA, bool isFreeB, float cap) {
+    a.push_back(slotA);
+    b.push_back(slotB);
+    restLength.push_back(rest);
+    stiffness.push_back(invMassA + invMassB > 0 ? strength / (invMassA + invMassB) : 0);
+    weightA.push_back(isFreeA ? invMassA : 0);
+    weightB.push_back(isFreeB ? invMassB : 0);
+    forceCap.push_back(cap);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void SpringBatchT<T>::solve(ParticleStoreT<T>& store, long begin, long end) const {
+#ifdef MSAPHYSICS_SIMD
+    long i = begin;
+    for(; i + kSimdWidth <= end; i += kSimdWidth) {
+        solveGroup(store, &a[i], &b[i], &restLength[i], &stiffness[i], &weightA[i], &weightB[i], &forceCap[i], kSimdWidth);
+    }
+
+    // pad the last group by repeating its first spring, so it gets the same maths as the rest
+    int n = end - i;
+    if(n > 0) {
+        int ia[kSimdWidth], ib[kSimdWidth];
+        float rest[kSimdWidth], k[kSimdWidth], wa[kSimdWidth], wb[kSimdWidth], cap[kSimdWidth];
+        for(int j=0; j<kSimdWidth; j++) {
+            long s = j < n ? i + j : i;
+            ia[j] = a[s]; ib[j] = b[s];
+            rest[j] = restLength[s]; k[j] = stiffness[s];
+            wa[j] = weightA[s]; wb[j] = weightB[s];
+            cap[j] = forceCap[s];
+        }
+        solveGroup(store, ia, ib, rest, k, wa, wb, cap, n);
+    }
+#else
+    solveScalar(store, begin, end);
+#endif
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void SpringBatchT<T>::solveScalar(ParticleStoreT<T>& store, long begin, long end) const {
+    for(long i=begin; i<end; i++) {
+        float delta[T::DIM];
+        float deltaLength2 = 0;
+        for(int d=0; d<T::DIM; d++) {
+            delta[d] = store.pos[d][b[i]] - store.pos[d][a[i]];
+            deltaLength2 += delta[d] * delta[d];
+        }
+        if(deltaLength2 <= 0) continue;
+
+        float deltaLength = sqrt(deltaLength2);
+        float force = stiffness[i] * (deltaLength - restLength[i]) / deltaLength;
+        float forceLength = fabsf(force) * deltaLength;
+        if(forceCap[i] > 0 && forceLength > forceCap[i]) force *= forceCap[i] / forceLength;
+
+        for(int d=0; d<T::DIM; d++) {
+            store.pos[d][a[i]] += delta[d] * force * weightA[i];
+            store.pos[d][b[i]] -= delta[d] * force * weightB[i];
+        }
+    }
+}
+
+
+#ifdef MSAPHYSICS_SIMD
+#ifdef __AVX2__
+
+//--------------------------------------------------------------
+template <typename T>
+void SpringBatchT<T>::solveGroup(ParticleStoreT<T>& store, const int *ia, const int *ib, const float *rest, const float *k, const float *wa, const float *wb, const float *cap, int n) {
+    __m256i va = _mm256_loadu_si256((const __m256i*)ia);
+    __m256i vb = _mm256_loadu_si256((const __m256i*)ib);
+
+    __m256 delta[T::DIM];
+    __m256 deltaLength2 = _mm256_setzero_ps();
+    for(int d=0; d<T::DIM; d++) {
+        const float *pos = store.pos[d].data();
+        delta[d] = _mm256_sub_ps(_mm256_i32gather_ps(pos, vb, 4), _mm256_i32gather_ps(pos, va, 4));
+        deltaLength2 = _mm256_add_ps(deltaLength2, _mm256_mul_ps(delta[d], delta[d]));
+    }
+
+    // 1/length from the rsqrt estimate plus one Newton-Raphson step
+    __m256 invLength = _mm256_rsqrt_ps(deltaLength2);
+    invLength = _mm256_mul_ps(invLength, _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), deltaLength2), _mm256_mul_ps(invLength, invLength))));
+    __m256 deltaLength = _mm256_mul_ps(deltaLength2, invLength);
+
+    __m256 force = _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(k), _mm256_sub_ps(deltaLength, _mm256_loadu_ps(rest))), invLength);
+    force = _mm256_and_ps(force, _mm256_cmp_ps(deltaLength2, _mm256_setzero_ps(), _CMP_GT_OQ));
+
+    __m256 vcap = _mm256_loadu_ps(cap);
+    __m256 forceLength = _mm256_mul_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), force), deltaLength);
+    __m256 isCapped = _mm256_and_ps(_mm256_cmp_ps(vcap, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(forceLength, vcap, _CMP_GT_OQ));
+    force = _mm256_blendv_ps(force, _mm256_mul_ps(force, _mm256_div_ps(vcap, forceLength)), isCapped);
+
+    __m256 forceA = _mm256_mul_ps(force, _mm256_loadu_ps(wa));
+    __m256 forceB = _mm256_mul_ps(force, _mm256_loadu_ps(wb));
+
+    // there is no scatter in AVX2, so write back one lane at a time
+    alignas(32) float moveA[8], moveB[8];
+    for(int d=0; d<T::DIM; d++) {
+        _mm256_store_ps(moveA, _mm256_mul_ps(delta[d], forceA));
+        _mm256_store_ps(moveB, _mm256_mul_ps(delta[d], forceB));
+        float *pos = store.pos[d].data();
+        for(int j=0; j<n; j++) {
+            pos[ia[j]] += moveA[j];
+            pos[ib[j]] -= moveB[j];
+        }
+    }
+}
+
+#else
+
+//--------------------------------------------------------------
+template <typename T>
+void SpringBatchT<T>::solveGroup(ParticleStoreT<T>& store, const int *ia, const int *ib, const float *rest, const float *k, const float *wa, const float *wb, const float *cap, int n) {
+    __m128 delta[T::DIM];
+    __m128 deltaLength2 = _mm_setzero_ps();
+    for(int d=0; d<T::DIM; d++) {
+        const float *pos = store.pos[d].data();
+        __m128 posA = _mm_setr_ps(pos[ia[0]], pos[ia[1]], pos[ia[2]], pos[ia[3]]);
+        __m128 posB = _mm_setr_ps(pos[ib[0]], pos[ib[1]], pos[ib[2]], pos[ib[3]]);
+        delta[d] = _mm_sub_ps(posB, posA);
+        deltaLength2 = _mm_add_ps(deltaLength2, _mm_mul_ps(delta[d], delta[d]));
+    }
+
+    // 1/length from the rsqrt estimate plus one Newton-Raphson step
+    __m128 invLength = _mm_rsqrt_ps(deltaLength2);
+    invLength = _mm_mul_ps(invLength, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), deltaLength2), _mm_mul_ps(invLength, invLength))));
+    __m128 deltaLength = _mm_mul_ps(deltaLength2, invLength);
+
+    __m128 force = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(k), _mm_sub_ps(deltaLength, _mm_loadu_ps(rest))), invLength);
+    force = _mm_and_ps(force, _mm_cmpgt_ps(deltaLength2, _mm_setzero_ps()));
+
+    __m128 vcap = _mm_loadu_ps(cap);
+    __m128 forceLength = _mm_mul_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), force), deltaLength);
+    __m128 isCapped = _mm_and_ps(_mm_cmpgt_ps(vcap, _mm_setzero_ps()), _mm_cmpgt_ps(forceLength, vcap));
+    force = _mm_or_ps(_mm_andnot_ps(isCapped, force), _mm_and_ps(isCapped, _mm_mul_ps(force, _mm_div_ps(vcap, forceLength))));
+
+    __m128 forceA = _mm_mul_ps(force, _mm_loadu_ps(wa));
+    __m128 forceB = _mm_mul_ps(force, _mm_loadu_ps(wb));
+
+    alignas(16) float moveA[4], moveB[4];
+    for(int d=0; d<T::DIM; d++) {
+        _mm_store_ps(moveA, _mm_mul_ps(delta[d], forceA));
+        _mm_store_ps(moveB, _mm_mul_ps(delta[d], forceB));
+        float *pos = store.pos[d].data();
+        for(int j=0; j<n; j++) {
+            pos[ia[j]] += moveA[j];
+            pos[ib[j]] -= moveB[j];
+        }
+    }
+}
+
+#endif
+#endif
+
+}
+}
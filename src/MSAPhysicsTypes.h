@@ -2,6 +2,9 @@
 
 #include "MSACore.h"
 
+namespace msa {
+namespace physics {
+
 template<typename T> class ParticleT;
 //template<typename T> using Particle_ptr         = shared_ptr< ParticleT<T> >;
 //template<typename T> using Particle_weakptr     = weak_ptr< ParticleT<T> >;
@@ -30,4 +33,12 @@ template<typename T> class SectorT;
 //template<typename T> using Sector_ptr           = shared_ptr< SectorT<T> >;
 //template<typename T> using Sector_weakptr       = weak_ptr< SectorT<T> >;
 
+template<typename T> class ParticleStoreT;
+template<typename T> class AttractorT;
+template<typename T> class EmitterT;
+
+
+}
+}
+
 
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "MSACore.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+namespace msa {
+namespace physics {
+
+// a persistent pool of threads for splitting loops over particles (or constraints) across cores
+// the thread calling parallelFor works too, so a pool of N threads starts N-1 of its own
+// parallelFor is not reentrant, don't call it from inside a job
+class WorkerPool {
+public:
+    typedef shared_ptr< WorkerPool >    WorkerPool_ptr;
+
+    static WorkerPool_ptr create(int numThreads)        { return WorkerPool_ptr(new WorkerPool(numThreads)); }
+
+    ~WorkerPool();
+
+    int                 getNumThreads() const           { return _threads.size() + 1; }
+
+    // split [begin, end) into chunks of at least minChunkSize, and call f(chunkBegin, chunkEnd) for each, across all threads
+    // returns when all chunks are done
+    template <typename F>
+    void                parallelFor(long begin, long end, F f, long minChunkSize = 1024);
+
+protected:
+    vector< thread >                    _threads;
+    mutex                               _mutex;
+    condition_variable                  _wake;
+    condition_variable                  _done;
+
+    const std::function<void(long)>    *_job;
+    long                                _numChunks;
+    std::atomic<long>                   _nextChunk;
+    unsigned long                       _generation;        // bumped for every job, so workers know there is something new
+    int                                 _numActive;         // workers still busy with the current job
+    bool                                _isQuitting;
+
+    WorkerPool(int numThreads);
+
+    void                runChunks();
+    void                workerLoop();
+};
+
+
+//--------------------------------------------------------------
+inline WorkerPool::WorkerPool(int numThreads) :
+    _job(nullptr), _numChunks(0), _nextChunk(0), _generation(0), _numActive(0), _isQuitting(false)
+{
+    for(int i=1; i<numThreads; i++) _threads.push_back(thread(&WorkerPool::workerLoop, this));
+}
+
+//--------------------------------------------------------------
+inline WorkerPool::~WorkerPool() {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _isQuitting = true;
+    }
+    _wake.notify_all();
+    for(auto&& t : _threads) t.join();
+}
+
+//--------------------------------------------------------------
+template <typename F>
+void WorkerPool::parallelFor(long begin, long end, F f, long minChunkSize) {
+    long n = end - begin;
+    if(n <= 0) return;
+
+    // a few chunks per thread, so one slow chunk doesn't hold everything up
+    long numChunks = std::min((long)getNumThreads() * 4, (n + minChunkSize - 1) / std::max(minChunkSize, 1L));
+    if(numChunks <= 1 || _threads.empty()) {
+        f(begin, end);
+        return;
+    }
+
+    long chunkSize = (n + numChunks - 1) / numChunks;
+    std::function<void(long)> job = [&](long c) {
+        long chunkBegin = begin + c * chunkSize;
+        long chunkEnd = std::min(end, chunkBegin + chunkSize);
+        if(chunkBegin < chunkEnd) f(chunkBegin, chunkEnd);
+    };
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        _job = &job;
+        _numChunks = numChunks;
+        _nextChunk = 0;
+        _numActive = _threads.size();
+        _generation++;
+    }
+    _wake.notify_all();
+
+    runChunks();
+
+    unique_lock<mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _numActive == 0; });
+    _job = nullptr;
+}
+
+//--------------------------------------------------------------
+inline void WorkerPool::runChunks() {
+    for(long c = _nextChunk++; c < _numChunks; c = _nextChunk++) (*_job)(c);
+}
+
+//--------------------------------------------------------------
+inline void WorkerPool::workerLoop() {
+    unsigned long lastGeneration = 0;
+    while(true) {
+        {
+            unique_lock<mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _isQuitting || _generation != lastGeneration; });
+            if(_isQuitting) return;
+            lastGeneration = _generation;
+        }
+
+        runChunks();
+
+        lock_guard<mutex> lock(_mutex);
+        if(--_numActive == 0) _done.notify_one();
+    }
+}
+
+}
+}
@@ -6,6 +6,26 @@
 namespace msa {
 namespace physics {
 
+// which springs the bulk builders make
+typedef enum BuildSprings {
+    kBuildStructuralSprings = 1,    // between neighbours along each axis
+    kBuildShearSprings      = 2,    // across the diagonals of each square
+    kBuildBendSprings       = 4,    // between particles two apart along each axis
+    kBuildAllSprings        = 7,
+} BuildSprings;
+
+// what a bulk builder made: handles of its particles, in x, then y, then z order, and of its springs, in order of the particle they start from
+// the world moves particles and springs around, but handles stay valid for as long as they are in it (see WorldT::resolve and WorldT::getParticle)
+struct BuildRange {
+    vector< ParticleHandle >    particles;
+    vector< ConstraintHandle >  springs;
+    long    numX, numY, numZ;
+
+    long    numberOfParticles() const                   { return particles.size(); }
+    long    numberOfSprings() const                     { return springs.size(); }
+    ParticleHandle  getParticle(long x, long y = 0, long z = 0) const  { return particles[(z * numY + y) * numX + x]; }
+};
+
 template <typename T>
 class WorldT : public enable_shared_from_this< WorldT<T> > {
 public:
@@ -16,40 +36,119 @@ public:
     typedef shared_ptr< SpringT<T> >          Spring_ptr;
     typedef shared_ptr< AttractionT<T> >      Attraction_ptr;
     typedef shared_ptr< ConstraintT<T> >      Constraint_ptr;
+    typedef shared_ptr< AttractorT<T> >       Attractor_ptr;
+    typedef shared_ptr< EmitterT<T> >         Emitter_ptr;
+    typedef RayHitT<T>                        RayHit;
 
     static World_ptr create()                           { return World_ptr(new WorldT<T>); }
 
+    virtual ~WorldT();
+
     Particle_ptr    makeParticle(const T& pos = T(), float mass = 1.0f, float drag = 1.0f);
     Spring_ptr      makeSpring(Particle_ptr a, Particle_ptr b, float strength, float restLength);
     Attraction_ptr  makeAttraction(Particle_ptr a, Particle_ptr b, float strength);
-
-    Particle_ptr    addParticle(Particle_ptr p)         { _particles.push_back(p); return p; }
-    Constraint_ptr  addConstraint(Constraint_ptr c)     { _constraints[c->type()].push_back(c); return c; }
+    Attractor_ptr   makeAttractor(AttractorType type, const T& pos, float strength);
+    Emitter_ptr     makeEmitter(const T& pos, float rate, float lifetime);
+
+    // allocator for the world's arena, where make... makes particles and constraints
+    // to make your own in there too, e.g. Particle3D::create(world->getAllocator< Particle3D >(), pos)
+    // or for your own classes (give ArenaAllocator access to the constructor), allocate_shared< MyParticle >(world->getAllocator< MyParticle >(), ...)
+    template <typename U>
+    ArenaAllocator< U > getAllocator() const            { return ArenaAllocator< U >(_arena); }
+
+    // bulk builders, which make a whole structure of particles joined by springs in one go (rest lengths are the starting distances)
+    // particles are added in order, so they sit next to each other in memory, and the world's arrays are grown once
+    BuildRange      makeRope(const T& start, const T& end, long numParticles, float strength, float mass = 1.0f, float drag = 1.0f);
+    BuildRange      makeSheet(const T& corner, const T& stepX, const T& stepY, long numX, long numY, float strength, unsigned int springs = kBuildAllSprings, float mass = 1.0f, float drag = 1.0f);
+    BuildRange      makeLattice(const T& corner, const T& step, long numX, long numY, long numZ, float strength, unsigned int springs = kBuildStructuralSprings | kBuildShearSprings, float mass = 1.0f, float drag = 1.0f);   // numZ is 1 in 2D
+
+    Particle_ptr    addParticle(Particle_ptr p);
+    Constraint_ptr  addConstraint(Constraint_ptr c);
+    Attractor_ptr   addAttractor(Attractor_ptr a)       { _attractors.push_back(a); return a; }
+    Emitter_ptr     addEmitter(Emitter_ptr e)           { _emitters.push_back(e); return e; }
 
     Particle_ptr    getParticle(long i)                 { return i < numberOfParticles() ? _particles[i] : nullptr; }
-    Spring_ptr      getSpring(long i)                   { return i < numberOfSprings() ? dynamic_pointer_cast< SpringT<T> >(_constraints[kConstraintTypeSpring][i]) : nullptr; }
-    Attraction_ptr	getAttraction(long i)               { return i < numberOfAttractions() ? dynamic_pointer_cast< AttractionT<T> >(_constraints[kConstraintTypeAttraction][i]) : nullptr; }
+    Spring_ptr      getSpring(long i)                   { return _springs->getConstraint(i); }
+    Attraction_ptr	getAttraction(long i)               { return _attractions->getConstraint(i); }
+    Attractor_ptr   getAttractor(long i)                { return i < numberOfAttractors() ? _attractors[i] : nullptr; }
+    Emitter_ptr     getEmitter(long i)                  { return i < numberOfEmitters() ? _emitters[i] : nullptr; }
 
     vector< Particle_ptr >& getParticles()                  { return _particles; }
     const vector< Particle_ptr >& getParticles() const      { return _particles; }
 
-    vector< Spring_ptr >& getSprings()                      { return _constraints[kConstraintTypeSpring]; }
-    const vector< Spring_ptr >& getSprings() const          { return _constraints[kConstraintTypeSpring]; }
+    vector< Spring_ptr >& getSprings()                      { return _springs->getConstraints(); }
+    const vector< Spring_ptr >& getSprings() const          { return _springs->getConstraints(); }
 
-    vector< Attraction_ptr >& getAttractions()              { return _constraints[kConstraintTypeAttraction]; }
-    const vector< Attraction_ptr >& getAttractions() const  { return _constraints[kConstraintTypeAttraction]; }
+    vector< Attraction_ptr >& getAttractions()              { return _attractions->getConstraints(); }
+    const vector< Attraction_ptr >& getAttractions() const  { return _attractions->getConstraints(); }
 
-    // find particle(s) at position, this does a search, so not instant, has overheads
+    vector< Attractor_ptr >& getAttractors()                { return _attractors; }
+    const vector< Attractor_ptr >& getAttractors() const    { return _attractors; }
+
+    vector< Emitter_ptr >& getEmitters()                    { return _emitters; }
+    const vector< Emitter_ptr >& getEmitters() const        { return _emitters; }
+
+    // find particle(s) at position
     vector<Particle_ptr> findParticles(const T& pos, float radius = FLT_EPSILON);
 
-    // findConstraint between particles. these do a search, so not instant, has some overheads
+    // spatial queries on particle centres, through a grid of all particles built by the first query after each update (or change in particles)
+    // results are particle indices (as in getParticle(i)) which are good until the next update. out is cleared first, and reused so there are no allocations once it's big enough
+    // if you move particles yourself between updates, call invalidateSpatialQueries()
+    void            findParticles(const T& pos, float radius, vector<long>& out);
+    void            findNearestParticles(const T& pos, int k, vector<long>& out);          // sorted nearest first
+    void            findParticlesInBox(const T& boxMin, const T& boxMax, vector<long>& out);
+
+    // many queries at once, split across the worker pool. out[i] is the result of query i
+    void            findParticles(const vector<T>& positions, float radius, vector< vector<long> >& out);
+    void            findNearestParticles(const vector<T>& positions, int k, vector< vector<long> >& out);
+    void            findParticlesInBox(const vector<T>& boxMins, const vector<T>& boxMaxs, vector< vector<long> >& out);
+
+    // ray and segment casts against particles, as spheres (circles in 2D) of their radius, through the same grid
+    // the ray steps through the cells it crosses, so the cost depends on the length of the ray, not the number of particles
+    // the first hit (false if there isn't one), or all hits sorted nearest first
+    bool            castRay(const T& origin, const T& direction, RayHit& hit, float maxDistance = FLT_MAX);
+    void            castRayAll(const T& origin, const T& direction, vector< RayHit >& hits, float maxDistance = FLT_MAX);
+    bool            castSegment(const T& a, const T& b, RayHit& hit);
+    void            castSegmentAll(const T& a, const T& b, vector< RayHit >& hits);
+
+    // size of the cells of the query grid. 0 (the default) to work it out from the number of particles and their spread
+    World_ptr       setQueryCellSize(float s)           { _params->queryCellSize = s; _isQueryGridDirty = true; return getThis(); }
+    World_ptr       invalidateSpatialQueries()          { _isQueryGridDirty = true; return getThis(); }
+
+    // lightweight references to particles and constraints, which stay valid while they are in the world (see MSAPhysicsHandle.h)
+    // get them with particle->getHandle() and constraint->getHandle()
+    bool            isValid(const ParticleHandle& h) const      { return _particleStore.handles.isValid(h); }
+    bool            isValid(const ConstraintHandle& h) const    { return _constraintHandles.isValid(h); }
+    Particle_ptr    getParticle(const ParticleHandle& h)        { long i = _particleStore.getSlot(h); return i >= 0 ? _particles[i] : nullptr; }
+    Constraint_ptr  getConstraint(const ConstraintHandle& h)    { ConstraintT<T> *c = resolve(h); return c ? c->shared_from_this() : nullptr; }
+
+    // the same without touching any reference counts. nullptr if the handle is stale
+    ParticleT<T>*   resolve(const ParticleHandle& h) const      { long i = _particleStore.getSlot(h); return i >= 0 ? _particleStore.owner[i] : nullptr; }
+    ConstraintT<T>* resolve(const ConstraintHandle& h) const    { return _constraintHandles.get(h, nullptr); }
+
+    // whether a constraint has been added to this world (the particle index is shared by all worlds a particle has constraints in)
+    bool            isInWorld(const ConstraintT<T>& c) const    { return resolve(c.getHandle()) == &c; }
+
+    // findConstraint between particles. these only look through the constraints attached to the particles (see ParticleT::getConstraints())
+    // so they take time proportional to the number of those, not the number in the world
     Constraint_ptr  findConstraint(Particle_ptr a, int constraintType);
     Constraint_ptr	findConstraint(Particle_ptr a, Particle_ptr b, int constraintType);
 
+    // give a custom constraint class its own list, so it's solved with a direct call to C::solve() instead of a virtual call per constraint
+    // constraints of exactly class C (not subclasses) go in it, including ones already in the world
+    template <typename C>
+    World_ptr       registerConstraintType();
+
+    // all constraints of a class given to registerConstraintType (nullptr if it hasn't been)
+    template <typename C>
+    ConstraintListT<T, C>* getConstraintList();
+
     long			numberOfParticles()                 { return _particles.size(); }
-    long			numberOfCustomConstraints()         { return _constraints[kConstraintTypeCustom].size(); }
-    long			numberOfSprings()                   { return _constraints[kConstraintTypeSpring].size(); }
-    long			numberOfAttractions()               { return _constraints[kConstraintTypeAttraction].size(); }
+    long			numberOfCustomConstraints()         { return _constraintLists[kConstraintTypeCustom]->size(); }     // not counting registered types
+    long			numberOfSprings()                   { return _springs->size(); }
+    long			numberOfAttractions()               { return _attractions->size(); }
+    long			numberOfAttractors()                { return _attractors.size(); }
+    long			numberOfEmitters()                  { return _emitters.size(); }
 
     // Drag. 1: no drag at all, 0.9: quite a lot of drag, 0: particles can't even move
     World_ptr		setDrag(float drag = 0.99f)         { _params->drag = drag; return getThis(); }
@@ -68,16 +167,64 @@ public:
     // for optimized collision, set world dimensions first
     World_ptr		setWorldMin(const T& worldMin)      { _params->worldMin = worldMin; updateWorldSize(); return getThis(); }
     World_ptr		setWorldMax(const T& worldMax)      { _params->worldMax = worldMax; updateWorldSize(); return getThis(); }
-    World_ptr		clearWorldSize()                    { _params->doWorldEdges = false; disableCollision(); return getThis(); }
+    World_ptr		clearWorldSize()                    { _params->doWorldEdges = false; _isNeighbourListDirty = true; return getThis(); }
     World_ptr		setWorldSize(const T& worldMin, const T& worldMax)  { setWorldMin(worldMin); setWorldMax(worldMax); return getThis(); }
 
     // and then set sector size (or count)
+    // without world dimensions, collision still works, but sectors are kept in a hash table and only created where there are particles
     World_ptr		enableCollision()                   { _params->isCollisionEnabled = true; return getThis(); }
     World_ptr		disableCollision()                  { _params->isCollisionEnabled = false; return getThis(); }
     bool			isCollisionEnabled() const          { return _params->isCollisionEnabled; }
-    World_ptr		setSectorCount(int count);		// set the number of sectors (will be equal in each axis)
+    World_ptr		setSectorCount(int count);		// set the number of sectors (will be equal in each axis). 0 to work it out from the largest particle
     World_ptr		setSectorCount(T vCount);// set the number of sectors in each axis
 
+    // how to find pairs of particles which might collide: sectors (the default), or sort and sweep along the axis the particles are most spread out on
+    // sort and sweep is better when particles are mostly spread along one axis (ropes, long flows)
+    World_ptr		setBroadphase(BroadphaseType b)     { _params->broadphase = b; _isNeighbourListDirty = _isSweepDirty = true; return getThis(); }
+    BroadphaseType	getBroadphase() const               { return _params->broadphase; }
+
+    // keep a list of all pairs of particles closer than their radii plus skin, and only rebuild it when a particle has moved more than skin/2
+    // great when most particles move much less than their radius per frame. a bigger skin means fewer rebuilds, but more pairs to check
+    World_ptr		enableNeighbourList(float skin);
+    World_ptr		disableNeighbourList()              { _params->doNeighbourList = false; return getThis(); }
+    bool			isNeighbourListEnabled() const      { return _params->doNeighbourList; }
+
+    // for particles of very different sizes: keep a hierarchy of sectors, each level twice the size of the one before
+    // each particle goes in the level which fits it, so small particles aren't all crammed into sectors sized for the biggest one
+    World_ptr		enableMultiLevelSectors()           { _params->doMultiLevelSectors = true; _isNeighbourListDirty = true; return getThis(); }
+    World_ptr		disableMultiLevelSectors()          { _params->doMultiLevelSectors = false; _isNeighbourListDirty = true; return getThis(); }
+    bool			isMultiLevelSectorsEnabled() const  { return _params->doMultiLevelSectors; }
+
+    // every particle attracts every other with strength * massA * massB / distance^2 (the same law as AttractionT), applied once per update
+    // without an AttractionT for each pair: groups of particles further away than their size / openingAngle are treated as one
+    // (0 is exact but O(N^2), 0.5 is usual, bigger is faster and rougher). negative strength repels
+    World_ptr		enableGlobalAttraction(float strength, float openingAngle = 0.5f);
+    World_ptr		disableGlobalAttraction()           { _params->doGlobalAttraction = false; return getThis(); }
+    bool			isGlobalAttractionEnabled() const   { return _params->doGlobalAttraction; }
+
+    // particles closer than cutoff attract each other with strength * massA * massB / distance^2, applied once per update. negative strength repels
+    // pairs are found through the sectors, so the cost is linear in the number of particles, and there are no AttractionT objects
+    // automatic sector sizes (the default) are at least cutoff. with a fixed sector count, make sure sectors are at least that big
+    World_ptr		enableShortRangeForce(float strength, float cutoff);
+    World_ptr		disableShortRangeForce()            { _params->doShortRangeForce = false; return getThis(); }
+    bool			isShortRangeForceEnabled() const    { return _params->doShortRangeForce; }
+
+    // particles which have moved less than speed per update (from where the last update left them, so gravity pulling a resting particle into the floor,
+    // only to be pushed back out, doesn't count), for frames updates in a row, are put to sleep along with everything joined to them
+    // through constraints or touching them (an island only sleeps once all of it is still). sleepers are skipped by integration, constraints and collision,
+    // until something wakes them: moving them or changing their velocity, an awake particle touching them, or a change to their constraints
+    // fixed particles anchor islands, but don't join them together (cloth hanging from a fixed bar can sleep a curtain at a time)
+    World_ptr		enableSleeping(float speed = 0.05f, int frames = 30);
+    World_ptr		disableSleeping();
+    bool			isSleepingEnabled() const           { return _params->doSleeping; }
+    long			numberOfSleepingParticles() const   { return _particleStore.numSleeping; }
+
+
+    // split particle integration, spring solving and collision across this many threads (1 to do everything on the calling thread)
+    // particle update() and collision callbacks are always called from the thread calling world::update()
+    World_ptr		setNumThreads(int n);
+    int				getNumThreads() const               { return _workerPool ? _workerPool->getNumThreads() : 1; }
+
     // preallocate buffers if you know how big they need to be (they grow automatically if need be)
     World_ptr		setParticleCount(long i);
     World_ptr		setCustomConstraintCount(long i);
@@ -101,21 +248,141 @@ public:
 
 protected:
     Params_ptr                           _params;
-    vector< Particle_ptr >               _particles;
-    map<int, vector< Constraint_ptr > >  _constraints;    // key: constraint type, value: vector of constraints
-    vector< Sector_ptr >                 _sectors;
+    vector< Particle_ptr >               _particles;      // _particles[i] is a view onto slot i of _particleStore
+    ParticleStoreT<T>                    _particleStore;
+    vector< shared_ptr< ConstraintListBaseT<T> > >  _constraintLists;   // indexed by constraint type, then one for each registered class
+    ConstraintListT<T, SpringT<T> >      *_springs;          // (the built in lists, with their type)
+    ConstraintListT<T, AttractionT<T> >  *_attractions;
+    typename ConstraintListBaseT<T>::HandleTable    _constraintHandles;
+    Arena::Arena_ptr                     _arena;            // make* and the builders make particles and constraints in here
+    vector< ConstraintHandle >           _constraintRemovalQueue;   // killed constraints (and those of killed particles), removed in the next update
+    vector< long >                       _deadSlots;
+    vector< long >                       _expiredSlots;      // particles which reached their lifetime this update
+    mutex                                _expiredSlotsMutex;
+    vector< unsigned char >              _islandVisited;     // for finding islands of still particles to put to sleep
+    vector< long >                       _island;
+    vector< long >                       _islandContacts;
+    vector< Attractor_ptr >              _attractors;
+    vector< Emitter_ptr >                _emitters;
+    WorkerPool::WorkerPool_ptr           _workerPool;
+    vector< T >                          _edgeForces;        // hits with the edge of the world, so callbacks can be called after the parallel part
+    vector< unsigned char >              _hasHitEdge;
+
+    // springs are split into batches where no two springs in a batch share a particle
+    // so each batch can be solved several springs at a time with SIMD, and across threads, and the result is the same as solving it serially
+    // springs which don't fit in any batch (a particle with more than kMaxSpringBatches springs) go in one extra batch, solved serially
+    enum { kMaxSpringBatches = 64 };
+    vector< vector< SpringT<T>* > >      _springBatches;
+    vector< SpringBatchT<T> >            _packedSpringBatches;   // the plain springs of each batch, packed every frame
+    vector< vector< SpringT<T>* > >      _unpackedSprings;       // springs of each batch which need their own solve() (subclasses, min or max distance)
+
+    vector< SectorT<T> >                 _sectors;
+    vector< int >                        _sectorNeighbours;  // offsets (DIM ints each) to half of the surrounding sectors
+
+    // parallel collision, with a grid of sectors and a worker pool
+    // the grid is split into blocks of 2^DIM sectors, and each block checks the pairs of sectors which have their lowest corner in it
+    // blocks are run in 2^DIM phases by the parity of their lowest corner, so blocks running at the same time never share a sector
+    struct CollisionHit { long a, b; T force; };
+    vector< unsigned char >              _sectorBlockPairs;  // pairs of block corners to check (as bit masks of the axes they are offset on)
+    vector< int >                        _sectorPhases;      // grid sectors sorted by phase
+    vector< int >                        _sectorPhaseStarts; // where each phase starts in _sectorPhases
+    vector< CollisionHit >               _collisionHits;     // so their callbacks can be called afterwards from this thread
+    mutex                                _collisionHitsMutex;
+    vector< int >                        _sectorCoords;      // coordinates and level (DIM+1 ints each) of each sector, when hashed
+    vector< int >                        _sectorHash;        // open addressing table of sector indices, when hashed
+    float                                _sectorSize;        // size of the finest sectors, when hashed
+    int                                  _numSectorLevels;
+    unsigned int                         _sectorLevelMask;   // which levels have particles in them
+
+    // used to sort particles by sector
+    vector< int >                        _particleSectors;   // sector index of each particle slot
+    vector< long >                       _sectorStarts;
+    vector< long >                       _sortOrder;
+    vector< long >                       _sortedSlots;       // the inverse of _sortOrder: where each slot moves to
+    vector< Particle_ptr >               _sortedParticles;
+    vector< float >                      _sortScratch;
+
+    // neighbour list (pairs of slots, and where the particles were when it was built)
+    vector< unsigned int >               _neighbourPairs;
+    vector< float >                      _neighbourBuildPos[T::DIM];
+    vector< float >                      _neighbourBuildRadius;
+    bool                                 _isNeighbourListDirty;
+
+    // sort and sweep
+    vector< unsigned int >               _sweepOrder;        // slots sorted by the low end of their interval on the sweep axis
+    vector< float >                      _sweepMin, _sweepMax;
+    int                                  _sweepAxis;
+    bool                                 _isSweepDirty;
+
+    // forces applied once per update
+    BarnesHutT<T>                        _barnesHut;
+    vector< T >                          _forces;            // move for each particle, so they are all worked out from the same positions
+
+    // spatial queries
+    QueryGridT<T>                        _queryGrid;
+    typename QueryGridT<T>::Heap         _queryHeap;
+    vector< RayHit >                     _rayHits;
+    bool                                 _isQueryGridDirty;
 
     bool _isInited;
 
     WorldT();
 
+    // call f(begin, end) over chunks of [begin, end), across the worker pool if there is one
+    template <typename F>
+    void    parallelFor(long begin, long end, F f, long minChunkSize = 1024)    { if(_workerPool) _workerPool->parallelFor(begin, end, f, minChunkSize); else f(begin, end); }
+
+    BuildRange  makeGrid(const T& corner, const T steps[3], const long counts[3], float strength, unsigned int springs, float mass, float drag);
+
+    void    updateEmitters();
     void	updateParticles();
+    void    ageParticles();
+    void    removeDeadParticles();
+    void    updateSleeping();
+    void    applyForces();
+    void    applyGlobalAttraction();
+    void    applyShortRangeForce();
+    void    applyAttractors();
     void    updateConstraints();
     //    void	updateConstraintsByType(vector<Constraint_ptr> constraints);
-
+    ConstraintListBaseT<T>* getConstraintListFor(const ConstraintT<T>& c);
+    void    removeConstraint(ConstraintT<T>& c);
+    void    removeDeadConstraints();
+
+    void    addSpringToBatch(SpringT<T> *s);
+    void    removeSpringFromBatch(SpringT<T> *s);
+    void    clearSpringBatches();
+    void    wakeDisturbedSprings();
+    void    packSpringBatches();
+    void    solveSpringBatches();
+
+    const QueryGridT<T>&    getQueryGrid();
     void    checkAllCollisions();
-
-    void	updateWorldSize()                           { _params->worldSize = _params->worldMax - _params->worldMin; _params->doWorldEdges	= true; }
+    void    checkCollisionsInPhases();
+    template <typename F> void forEachCandidatePair(F f);
+    void    updateSweep();
+    void    updateSectors();
+    void    createSectors(const T& vCount);
+    int     getNumGridSectors() const;
+    int     getSectorIndex(long i) const;
+    void    sortParticlesBySector();
+    template <typename F> void forEachSectorPair(F f) const;
+
+    // sectors are hashed when there are no world bounds, or there are multiple levels
+    // they are identified by their coordinates plus their level
+    enum { kSectorKeySize = T::DIM + 1, kMaxSectorLevels = 16 };
+    bool    isSectorHashEnabled() const                 { return !_params->doWorldEdges || _params->doMultiLevelSectors; }
+    bool    isInSectors(long i) const                   { return (_particleStore.flags[i] & kParticleFlagCollision) || _params->doShortRangeForce; }
+    void    getParticleSectorCoords(long i, int *coords) const;
+    void    getSectorCoords(int s, int *coords) const;
+    int     findSector(const int *coords) const;        // -1 if there is no such sector
+    int     findOrAddHashedSector(const int *coords);
+    static unsigned int hashSectorCoords(const int *coords);
+
+    bool    needsNeighbourListUpdate() const;
+    void    updateNeighbourList();
+
+    void	updateWorldSize()                           { _params->worldSize = _params->worldMax - _params->worldMin; _params->doWorldEdges	= true; _isNeighbourListDirty = true; }
 
 
 #ifdef MSAPHYSICS_USE_RECORDER
@@ -132,6 +399,22 @@ protected:
 template <typename T>
 WorldT<T>::WorldT() {
     _isInited = false;
+    _arena = Arena::create();
+    _isNeighbourListDirty = true;
+    _isSweepDirty = true;
+    _isQueryGridDirty = true;
+    _sweepAxis = 0;
+    _sectorSize = 0;
+    _numSectorLevels = 1;
+    _sectorLevelMask = 0;
+
+    // subclasses of the built in constraints go in their lists, and are solved with their own solve()
+    _constraintLists.resize(kConstraintTypeCount);
+    _constraintLists[kConstraintTypeCustom] = make_shared< ConstraintListT<T, ConstraintT<T> > >(kConstraintTypeCustom, true);
+    _constraintLists[kConstraintTypeSpring] = make_shared< ConstraintListT<T, SpringT<T> > >(kConstraintTypeSpring, true);
+    _constraintLists[kConstraintTypeAttraction] = make_shared< ConstraintListT<T, AttractionT<T> > >(kConstraintTypeAttraction, true);
+    _springs = static_cast< ConstraintListT<T, SpringT<T> >* >(_constraintLists[kConstraintTypeSpring].get());
+    _attractions = static_cast< ConstraintListT<T, AttractionT<T> >* >(_constraintLists[kConstraintTypeAttraction].get());
 
     _params = make_shared< ParamsT<T> >();
     setTimeStep(0.000010);
@@ -141,6 +424,13 @@ WorldT<T>::WorldT() {
     setGravity();
     clearWorldSize();
     setSectorCount(0);
+    setBroadphase(kBroadphaseSectors);
+    disableNeighbourList();
+    disableMultiLevelSectors();
+    disableGlobalAttraction();
+    disableShortRangeForce();
+    disableSleeping();
+    setQueryCellSize(0);
 
 #ifdef MSAPHYSICS_USE_RECORDER
     _frameCounter = 0;
@@ -152,17 +442,29 @@ WorldT<T>::WorldT() {
 }
 
 
+//--------------------------------------------------------------
+template <typename T>
+WorldT<T>::~WorldT() {
+    // particles and constraints might outlive the world, so give particles their data back, and unhook the constraints
+    for(auto&& p : _particles) p->detach();
+    clearSpringBatches();
+    for(auto&& l : _constraintLists) {
+        for(long i=0; i<l->size(); i++) removeConstraint(*l->get(i));
+    }
+}
+
+
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::Particle_ptr WorldT<T>::makeParticle(const T& pos, float mass, float drag) {
-    return addParticle(ParticleT<T>::create(pos, mass, drag));
+    return addParticle(ParticleT<T>::create(getAllocator< ParticleT<T> >(), pos, mass, drag));
 }
 
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::Spring_ptr WorldT<T>::makeSpring(Particle_ptr a, Particle_ptr b, float strength, float restLength) {
     if(a==b) return nullptr;
-    auto c = SpringT<T>::create(a, b, strength, restLength);
+    auto c = SpringT<T>::create(getAllocator< SpringT<T> >(), a, b, strength, restLength);
     addConstraint(c);
     return c;
 }
@@ -171,25 +473,130 @@ typename WorldT<T>::Spring_ptr WorldT<T>::makeSpring(Particle_ptr a, Particle_pt
 template <typename T>
 typename WorldT<T>::Attraction_ptr WorldT<T>::makeAttraction(Particle_ptr a, Particle_ptr b, float strength) {
     if(a==b) return nullptr;
-    auto c = AttractionT<T>::create(a, b, strength);
+    auto c = AttractionT<T>::create(getAllocator< AttractionT<T> >(), a, b, strength);
     addConstraint(c);
     return c;
 }
 
+//--------------------------------------------------------------
+template <typename T>
+typename WorldT<T>::Attractor_ptr WorldT<T>::makeAttractor(AttractorType type, const T& pos, float strength) {
+    return addAttractor(AttractorT<T>::create(type, pos, strength));
+}
+
+//--------------------------------------------------------------
+template <typename T>
+typename WorldT<T>::Emitter_ptr WorldT<T>::makeEmitter(const T& pos, float rate, float lifetime) {
+    return addEmitter(EmitterT<T>::create(pos, rate, lifetime));
+}
+
+//--------------------------------------------------------------
+template <typename T>
+BuildRange WorldT<T>::makeRope(const T& start, const T& end, long numParticles, float strength, float mass, float drag) {
+    T steps[3];
+    if(numParticles > 1) steps[0] = (end - start) / (numParticles - 1);
+    long counts[3] = { numParticles, 1, 1 };
+    return makeGrid(start, steps, counts, strength, kBuildStructuralSprings, mass, drag);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+BuildRange WorldT<T>::makeSheet(const T& corner, const T& stepX, const T& stepY, long numX, long numY, float strength, unsigned int springs, float mass, float drag) {
+    T steps[3] = { stepX, stepY, T() };
+    long counts[3] = { numX, numY, 1 };
+    return makeGrid(corner, steps, counts, strength, springs, mass, drag);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+BuildRange WorldT<T>::makeLattice(const T& corner, const T& step, long numX, long numY, long numZ, float strength, unsigned int springs, float mass, float drag) {
+    T steps[3];
+    long counts[3] = { numX, numY, T::DIM > 2 ? numZ : 1 };
+    for(int d=0; d<T::DIM && d<3; d++) steps[d][d] = step[d];
+    return makeGrid(corner, steps, counts, strength, springs, mass, drag);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+BuildRange WorldT<T>::makeGrid(const T& corner, const T steps[3], const long counts[3], float strength, unsigned int springs, float mass, float drag) {
+    BuildRange r;
+    r.numX = std::max(counts[0], 0L);
+    r.numY = std::max(counts[1], 1L);
+    r.numZ = std::max(counts[2], 1L);
+    long n = r.numX * r.numY * r.numZ;
+    long dims[3] = { r.numX, r.numY, r.numZ };
+
+    // offsets to the neighbours each particle gets a spring to. all forwards (or sideways), so each spring is made once
+    struct Link { long d[3]; };
+    vector< Link > links;
+    for(int a=0; a<3; a++) {
+        Link l = {{ 0, 0, 0 }};
+        l.d[a] = 1;
+        if((springs & kBuildStructuralSprings) && dims[a] > 1) links.push_back(l);
+        l.d[a] = 2;
+        if((springs & kBuildBendSprings) && dims[a] > 2) links.push_back(l);
+        for(int b=a+1; b<3; b++) {
+            if(!(springs & kBuildShearSprings) || dims[a] < 2 || dims[b] < 2) continue;
+            Link s = {{ 0, 0, 0 }};
+            s.d[a] = 1;
+            s.d[b] = 1;
+            links.push_back(s);
+            s.d[b] = -1;
+            links.push_back(s);
+        }
+    }
+
+    // grow everything once
+    long particleBegin = _particles.size();
+    long springBegin = _springs->size();
+    _particles.reserve(particleBegin + n);
+    _particleStore.reserve(particleBegin + n);
+    _springs->reserve(springBegin + n * links.size());
+    r.particles.reserve(n);
+    r.springs.reserve(n * links.size());
+
+    for(long z=0; z<r.numZ; z++) {
+        for(long y=0; y<r.numY; y++) {
+            for(long x=0; x<r.numX; x++) {
+                auto p = ParticleT<T>::create(getAllocator< ParticleT<T> >(), corner + steps[0] * x + steps[1] * y + steps[2] * z, mass, drag);
+                p->_constraints.reserve(links.size() * 2);
+                addParticle(p);
+                r.particles.push_back(p->getHandle());
+            }
+        }
+    }
+
+    // (nothing has been sorted yet, so the particles are still where they were added)
+    auto getIndex = [&r, particleBegin](long x, long y, long z) { return particleBegin + (z * r.numY + y) * r.numX + x; };
+    for(long z=0; z<r.numZ; z++) {
+        for(long y=0; y<r.numY; y++) {
+            for(long x=0; x<r.numX; x++) {
+                const Particle_ptr &a = _particles[getIndex(x, y, z)];
+                for(auto&& l : links) {
+                    long bx = x + l.d[0], by = y + l.d[1], bz = z + l.d[2];
+                    if(bx < 0 || bx >= r.numX || by < 0 || by >= r.numY || bz < 0 || bz >= r.numZ) continue;
+                    const Particle_ptr &b = _particles[getIndex(bx, by, bz)];
+                    float restLength = sqrt((b->getPosition() - a->getPosition()).lengthSquared());
+                    r.springs.push_back(addConstraint(SpringT<T>::create(getAllocator< SpringT<T> >(), a, b, strength, restLength))->getHandle());
+                }
+            }
+        }
+    }
+    return r;
+}
 
 
-////--------------------------------------------------------------
-//template <typename T>
-//typename WorldT<T>::Particle_ptr WorldT<T>::addParticle(Particle_ptr p) {
-//    _particles.push_back(p); return p;
-//}
 
-////--------------------------------------------------------------
-//template <typename T>
-//typename WorldT<T>::Constraint_ptr WorldT<T>::addConstraint(Constraint_ptr c) {
-//    _constraints[c->type()].push_back(c); return c;
-//}
 
+//--------------------------------------------------------------
+template <typename T>
+typename WorldT<T>::Particle_ptr WorldT<T>::addParticle(Particle_ptr p) {
+    if(!p || p->_store) return p;    // already in a world
+    p->attach(&_particleStore);
+    _particles.push_back(p);
+    _isNeighbourListDirty = _isSweepDirty = _isQueryGridDirty = true;
+    return p;
+}
 
 //--------------------------------------------------------------
 //template <typename T>
@@ -317,6 +724,12 @@ typename WorldT<T>::World_ptr WorldT<T>::setGravity(const T& g) {
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::World_ptr WorldT<T>::setSectorCount(int count) {
+    if(count <= 0) {
+        _params->doAutoSectorCount = true;
+        if(_sectors.empty()) createSectors(T());
+        return getThis();
+    }
+
     T r;
     for(int i=0; i<T::DIM; i++) r[i] = count;
     setSectorCount(r);
@@ -326,31 +739,268 @@ typename WorldT<T>::World_ptr WorldT<T>::setSectorCount(int count) {
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::World_ptr WorldT<T>::setSectorCount(T vCount) {
-    for(int i=0; i<T::DIM; i++) if(vCount[i] <= 0) vCount[i] = 1;
+    _params->doAutoSectorCount = false;
+    createSectors(vCount);
+    return getThis();
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::createSectors(const T& count) {
+    T vCount(count);
+    for(int i=0; i<T::DIM; i++) vCount[i] = vCount[i] < 1 ? 1 : floor(vCount[i]);
 
     _params->sectorCount = vCount;
+    _isNeighbourListDirty = true;
 
-    //	params.sectorCount.x = 1 << (int)vPow.x;
-    //	params.sectorCount.y = 1 << (int)vPow.y;
-    //	params.sectorCount.z = 1 << (int)vPow.z;
+    _sectors.assign(getNumGridSectors(), SectorT<T>());
 
-    //	T sectorSize = params.worldSize / sectorCount;
-    _sectors.clear();
 
+    // offsets to the neighbouring sectors which come after this one (in the order of the sector index)
+    // so that each pair of neighbouring sectors is only visited once
+    if(_sectorNeighbours.empty()) {
+        int numOffsets = 1;
+        for(int i=0; i<T::DIM; i++) numOffsets *= 3;
+        for(int o=0; o<numOffsets; o++) {
+            int offset[T::DIM];
+            int t = o;
+            int firstNonZero = 0;
+            for(int i=0; i<T::DIM; i++) {
+                offset[i] = t % 3 - 1;
+                t /= 3;
+                if(offset[i]) firstNonZero = offset[i];    // ends up with the highest axis which isn't zero
+            }
+            if(firstNonZero > 0) _sectorNeighbours.insert(_sectorNeighbours.end(), offset, offset + T::DIM);
+        }
+    }
+
+    // each pair of neighbouring sectors has a unique lowest corner (the min of their coordinates on each axis)
+    // within the block at that corner, they are two corners which aren't offset on the same axis
+    if(_sectorBlockPairs.empty()) {
+        for(int a=0; a<(1 << T::DIM); a++) {
+            for(int b=a; b<(1 << T::DIM); b++) {
+                if((a & b) == 0 && (a != b || a == 0)) {
+                    _sectorBlockPairs.push_back(a);
+                    _sectorBlockPairs.push_back(b);
+                }
+            }
+        }
+    }
+
+    // the phase of a block is the parity of its lowest corner on each axis
+    auto getSectorPhase = [this](int s) {
+        int phase = 0;
+        for(int i=0; i<T::DIM; i++) {
+            int count = _params->sectorCount[i];
+            phase |= ((s % count) & 1) << i;
+            s /= count;
+        }
+        return phase;
+    };
+    int numSectors = _sectors.size();
+
+    _sectorPhaseStarts.assign((1 << T::DIM) + 1, 0);
+    _sectorPhases.resize(numSectors);
+    for(int s=0; s<numSectors; s++) _sectorPhaseStarts[getSectorPhase(s) + 1]++;
+    for(int p=1; p<=(1 << T::DIM); p++) _sectorPhaseStarts[p] += _sectorPhaseStarts[p - 1];
+    vector< int > next(_sectorPhaseStarts.begin(), _sectorPhaseStarts.end() - 1);
+    for(int s=0; s<numSectors; s++) _sectorPhases[next[getSectorPhase(s)]++] = s;
+}
+
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::updateSectors() {
+    bool isHashed = isSectorHashEnabled();
+
+    if(_params->doAutoSectorCount || isHashed) {
+        // sectors need to be at least as big as the largest possible collision distance
+        float minRadius = FLT_MAX;
+        float maxRadius = 0;
+        for(long i=0; i<_particleStore.size(); i++) {
+            float radius = _particleStore.radius[i];
+            if((_particleStore.flags[i] & kParticleFlagCollision) == 0) continue;
+            maxRadius = std::max(maxRadius, radius);
+            if(radius > 0) minRadius = std::min(minRadius, radius);
+        }
+
+        // (candidates for the neighbour list are found at up to an extra skin apart, and the short range force reaches out to its cutoff)
+        float skin = _params->doNeighbourList ? _params->neighbourSkin : 0;
+        float cutoff = _params->doShortRangeForce ? _params->shortRangeCutoff : 0;
+        float sectorSize = std::max(maxRadius * 2 + skin, cutoff);
+        _numSectorLevels = 1;
+
+        // with levels, the finest sectors fit the smallest particle, and each level is twice the size of the one before
+        if(_params->doMultiLevelSectors && maxRadius > 0) {
+            float maxSectorSize = sectorSize;
+            sectorSize = std::max(minRadius * 2 + skin, cutoff);
+            for(float s = sectorSize; s < maxSectorSize && _numSectorLevels < kMaxSectorLevels; s *= 2) _numSectorLevels++;
+        }
+
+        // without world bounds, sectors are only created where there are particles, so just use that size
+        if(isHashed) {
+            for(int i=0; i<T::DIM; i++) _params->sectorSizeInv[i] = sectorSize > 0 ? 1.0f / sectorSize : 0;
+            _sectorSize = sectorSize;
+            return;
+        }
+
+        T vCount;
+        float numSectors = 1;
+        for(int i=0; i<T::DIM; i++) {
+            vCount[i] = sectorSize > 0 ? std::max(1.0f, floorf(_params->worldSize[i] / sectorSize)) : 1;
+            numSectors *= vCount[i];
+        }
+
+        // don't let the grid get silly big for tiny particles in a large world
+        float maxSectors = std::max(numberOfParticles(), 1L);
+        if(numSectors > maxSectors) {
+            float scale = pow(numSectors / maxSectors, 1.0f / T::DIM);
+            for(int i=0; i<T::DIM; i++) vCount[i] = std::max(1.0f, floorf(vCount[i] / scale));
+        }
+
+        bool changed = false;
+        for(int i=0; i<T::DIM; i++) if(vCount[i] != _params->sectorCount[i]) changed = true;
+        if(changed) createSectors(vCount);
+    }
+
+    // (sectors might have been hashed last frame)
+    if((int)_sectors.size() != getNumGridSectors()) createSectors(_params->sectorCount);
+
+    for(int i=0; i<T::DIM; i++) {
+        _params->sectorSizeInv[i] = _params->worldSize[i] > 0 ? _params->sectorCount[i] / _params->worldSize[i] : 0;
+    }
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+int WorldT<T>::getNumGridSectors() const {
     int numSectors = 1;
     for(int i=0; i<T::DIM; i++) numSectors *= _params->sectorCount[i];
-    for(int i=0; i<numSectors; i++) _sectors.push_back(SectorT<T>::create());
-    return getThis();
+    return numSectors;
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::getSectorCoords(int s, int *coords) const {
+    if(isSectorHashEnabled()) {
+        for(int i=0; i<kSectorKeySize; i++) coords[i] = _sectorCoords[s * kSectorKeySize + i];
+    } else {
+        for(int i=0; i<T::DIM; i++) {
+            int count = _params->sectorCount[i];
+            coords[i] = s % count;
+            s /= count;
+        }
+        coords[T::DIM] = 0;
+    }
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+int WorldT<T>::findSector(const int *coords) const {
+    if(isSectorHashEnabled()) {
+        if(_sectorHash.empty()) return -1;
+        unsigned int mask = _sectorHash.size() - 1;
+        for(unsigned int h = hashSectorCoords(coords) & mask; ; h = (h + 1) & mask) {
+            int s = _sectorHash[h];
+            if(s < 0) return -1;
+            if(equal(coords, coords + kSectorKeySize, &_sectorCoords[s * kSectorKeySize])) return s;
+        }
+    }
+
+    int sectorIndex = 0;
+    int stride = 1;
+    for(int i=0; i<T::DIM; i++) {
+        int count = _params->sectorCount[i];
+        if(coords[i] < 0 || coords[i] >= count) return -1;
+        sectorIndex += coords[i] * stride;
+        stride *= count;
+    }
+    return sectorIndex;
 }
 
 
+//--------------------------------------------------------------
+template <typename T>
+int WorldT<T>::findOrAddHashedSector(const int *coords) {
+    unsigned int mask = _sectorHash.size() - 1;
+    unsigned int h = hashSectorCoords(coords) & mask;
+    for(; _sectorHash[h] >= 0; h = (h + 1) & mask) {
+        int s = _sectorHash[h];
+        if(equal(coords, coords + kSectorKeySize, &_sectorCoords[s * kSectorKeySize])) return s;
+    }
+    int s = _sectorCoords.size() / kSectorKeySize;
+    _sectorCoords.insert(_sectorCoords.end(), coords, coords + kSectorKeySize);
+    _sectorHash[h] = s;
+    return s;
+}
 
 
+//--------------------------------------------------------------
+template <typename T>
+unsigned int WorldT<T>::hashSectorCoords(const int *coords) {
+    static const unsigned int primes[] = { 73856093u, 19349663u, 83492791u, 50331653u, 2654435761u };
+    unsigned int h = 0;
+    for(int i=0; i<kSectorKeySize; i++) h ^= (unsigned int)coords[i] * primes[i % 5];
+    return h;
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::getParticleSectorCoords(long p, int *coords) const {
+    // the level is the first one with sectors big enough for the particle
+    int level = 0;
+    if(_numSectorLevels > 1) {
+        float size = _particleStore.radius[p] * 2 + (_params->doNeighbourList ? _params->neighbourSkin : 0);
+        for(float s = _sectorSize; s < size && level < _numSectorLevels - 1; s *= 2) level++;
+    }
+    coords[T::DIM] = level;
+
+    float levelScale = 1.0f / (1 << level);
+    for(int i=0; i<T::DIM; i++) {
+        float t = floorf((_particleStore.pos[i][p] - _params->worldMin[i]) * _params->sectorSizeInv[i] * levelScale);
+
+        coords[i] = t < -(1<<30) ? -(1<<30) : (t > (1<<30) ? (1<<30) : t);
+    }
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+int WorldT<T>::getSectorIndex(long p) const {
+    int sectorIndex = 0;
+    int stride = 1;
+    for(int i=0; i<T::DIM; i++) {
+        int count = _params->sectorCount[i];
+        int t = (_particleStore.pos[i][p] - _params->worldMin[i]) * _params->sectorSizeInv[i];
+        t = t < 0 ? 0 : (t >= count ? count - 1 : t);
+        sectorIndex += t * stride;
+        stride *= count;
+    }
+    return sectorIndex;
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+typename WorldT<T>::World_ptr WorldT<T>::setNumThreads(int n) {
+    if(n == getNumThreads()) return getThis();
+    _workerPool = n > 1 ? WorkerPool::create(n) : nullptr;
+    return getThis();
+}
+
 
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::World_ptr WorldT<T>::setParticleCount(long i) {
+
     _particles.reserve(i);
+    _particleStore.reserve(i);
 #ifdef MSAPHYSICS_USE_RECORDER
     //	if(_replayMode == OFX_MSA_DATA_SAVE)
     _recorder.setSize(i);
@@ -362,21 +1012,21 @@ typename WorldT<T>::World_ptr WorldT<T>::setParticleCount(long i) {
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::World_ptr WorldT<T>::setCustomConstraintCount(long i){
-    _constraints[kConstraintTypeCustom].reserve(i);
+    _constraintLists[kConstraintTypeCustom]->reserve(i);
     return getThis();
 }
 
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::World_ptr WorldT<T>::setSpringCount(long i){
-    _constraints[kConstraintTypeSpring].reserve(i);
+    _springs->reserve(i);
     return getThis();
 }
 
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::World_ptr WorldT<T>::setAttractionCount(long i){
-    _constraints[kConstraintTypeAttraction].reserve(i);
+    _attractions->reserve(i);
     return getThis();
 }
 
@@ -384,30 +1034,52 @@ typename WorldT<T>::World_ptr WorldT<T>::setAttractionCount(long i){
 //--------------------------------------------------------------
 template <typename T>
 void WorldT<T>::clear() {
+    for(auto&& p : _particles) p->detach();
     _particles.clear();
-    _constraints.clear();
-    for(auto s: _sectors) s->clear();
+    _particleStore.clear();
+    _isNeighbourListDirty = _isSweepDirty = _isQueryGridDirty = true;
+    clearSpringBatches();   // (before the lists let go of the springs)
+    for(auto&& l : _constraintLists) {
+        for(long i=0; i<l->size(); i++) removeConstraint(*l->get(i));
+        l->clear();
+    }
+    _constraintRemovalQueue.clear();
+    _attractors.clear();
+    _emitters.clear();
+
+    // the old arena goes when the last object made in it does (straight away, unless you're holding on to some)
+    _arena = Arena::create();
+
+    for(auto&& s : _sectors) s.setRange(0, 0);
 }
 
 
 //--------------------------------------------------------------
 template <typename T>
 void WorldT<T>::update(int frameNum) {
+    _isQueryGridDirty = true;
 #ifdef MSAPHYSICS_USE_RECORDER
     if(frameNum < 0) frameNum = _frameCounter;
     if(_replayMode == OFX_MSA_DATA_LOAD) {
         load(frameNum);
     } else {
+        updateEmitters();
         updateParticles();
+        applyForces();
         updateConstraints();
         if(isCollisionEnabled()) checkAllCollisions();
+        if(isSleepingEnabled()) updateSleeping();
         if(_replayMode == OFX_MSA_DATA_SAVE) _recorder.save(frameNum);
     }
     _frameCounter++;
 #else
+    (void)frameNum;     // only the recorder uses it
+    updateEmitters();
     updateParticles();
+    applyForces();
     updateConstraints();
     if(isCollisionEnabled()) checkAllCollisions();
+    if(isSleepingEnabled()) updateSleeping();
 #endif
 }
 
@@ -415,14 +1087,14 @@ void WorldT<T>::update(int frameNum) {
 //--------------------------------------------------------------
 template <typename T>
 void WorldT<T>::draw() {
-    for(auto&& vc : _constraints) for(auto&& c : vc.second) c->draw();
+    for(auto&& l : _constraintLists) l->draw();
     for(auto&& p : _particles) p->draw();
 }
 
 //--------------------------------------------------------------
 template <typename T>
 void WorldT<T>::debugDraw() {
-    for(auto&& vc : _constraints) for(auto&& c : vc->second) c->debugDraw();
+    for(auto&& l : _constraintLists) l->debugDraw();
     for(auto&& p : _particles) p->debugDraw();
 }
 
@@ -440,88 +1112,346 @@ void WorldT<T>::load(long frameNum) {
 
 //--------------------------------------------------------------
 template <typename T>
-void WorldT<T>::updateParticles() {
+void WorldT<T>::removeDeadParticles() {
+    // only the particles killed since last time are looked at, so this costs nothing when nothing died
+    ParticleStoreT<T> &s = _particleStore;
+    if(s.killed.empty()) return;
+
+    _deadSlots.clear();
+    for(auto&& h : s.killed) {
+        long i = s.getSlot(h);
+        if(i >= 0) _deadSlots.push_back(i);
+    }
+    s.killed.clear();
+    if(_deadSlots.empty()) return;
+
+    // fill each hole with the last particle. going from the highest slot down, the last particle is never one still to be removed
+    sort(_deadSlots.begin(), _deadSlots.end(), greater< long >());
+    _deadSlots.erase(unique(_deadSlots.begin(), _deadSlots.end()), _deadSlots.end());
+    for(long i : _deadSlots) {
+        _particles[i]->detach();
+        long last = _particles.size() - 1;
+        if(i != last) {
+            s.moveSlot(i, last);
+            _particles[i] = std::move(_particles[last]);
+        }
+        _particles.pop_back();
+        s.resize(last);
+    }
+    _isNeighbourListDirty = _isSweepDirty = _isQueryGridDirty = true;
+}
 
-    // remove dead particles first
-    _particles.erase( remove_if(_particles.begin(), _particles.end(), [](const Particle_ptr &o) { return o->isDead(); }), _particles.end());
-
-    // update remaining particles
-    for(auto&& p : _particles) {
-        // do verlet
-        {
-            if(p->isFree()) {
-                if(_params->doGravity) p->addVelocity(_params->gravity);
-
-                T curPos(p->getPosition());
-                T vel(p->getVelocity());
-                p->moveBy(vel * _params->drag * p->getDrag());// + timeStep2;
-                //_pos += (_pos - _oldPos);// + timeStep2;	// TODO
-                p->setOldPosition(curPos);
-            }
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::updateEmitters() {
+    _emitters.erase( remove_if(_emitters.begin(), _emitters.end(), [](const Emitter_ptr &e) { return e->isDead(); }), _emitters.end());
+    for(auto&& e : _emitters) e->update(*this);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::ageParticles() {
+    // each chunk ages its particles, then counts how many have reached their lifetime (both plain loops over the arrays, which vectorise),
+    // and only if there are any, goes through again collecting their slots
+    // (in a buffer on the stack, which is added to _expiredSlots when it's full, so nothing is allocated once that has grown)
+    ParticleStoreT<T> &s = _particleStore;
+    _expiredSlots.clear();
+    parallelFor(0, s.size(), [this, &s](long begin, long end) {
+        float *age = s.age.data();
+        const float *lifetime = s.lifetime.data();
+        for(long i=begin; i<end; i++) age[i] += 1;
+
+        long numExpired = 0;
+        for(long i=begin; i<end; i++) numExpired += (lifetime[i] > 0) & (age[i] >= lifetime[i]);
+        if(numExpired == 0) return;
+
+        enum { kBufferSize = 64 };
+        long expired[kBufferSize];
+        int count = 0;
+        auto flush = [this, &expired, &count]() {
+            lock_guard< mutex > lock(_expiredSlotsMutex);
+            _expiredSlots.insert(_expiredSlots.end(), expired, expired + count);
+            count = 0;
+        };
+        for(long i=begin; i<end; i++) {
+            expired[count] = i;
+            count += (lifetime[i] > 0) & (age[i] >= lifetime[i]);
+            if(count == kBufferSize) flush();
         }
+        if(count) flush();
+    });
+    if(_expiredSlots.empty()) return;
+
+    // killing queues them for removal (along with their constraints), so it's done here rather than on the workers
+    // in slot order, so the order things are removed in doesn't depend on the threads
+    sort(_expiredSlots.begin(), _expiredSlots.end());
+    for(long i : _expiredSlots) s.owner[i]->kill();
+}
 
-        p->update();
-        //        this->applyUpdaters(particle);    // TODO: bring back updaters
-        if(_params->doWorldEdges) {
-            //				if(p->isFree())
-            bool collided = false;
-            T vel(p->getVelocity());
-            T pos(p->getPosition());
-            T oldPos(pos);
-            float radius = p->getRadius();
-            float bounce = p->getBounce();
-            for(int i=0; i<T::DIM; i++) {
-                //				r[i] = _radius;
-
-                float speed = vel[i];
-                if(pos[i] < _params->worldMin[i] + radius) {
-                    pos[i] = _params->worldMin[i] + radius;
-                    oldPos[i] = pos[i] + speed * bounce;
-                    collided = true;
-                } else if(pos[i] > _params->worldMax[i] - radius) {
-                    pos[i] = _params->worldMax[i] - radius;
-                    oldPos[i] = pos[i] + speed * bounce;
-                    collided = true;
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::updateSleeping() {
+    ParticleStoreT<T> &s = _particleStore;
+    long n = s.size();
+
+    // wake sleepers which were pushed hard enough during this update (along with their islands), and those which were touched by
+    // something awake. those haven't moved, so carry on counting how long they've been still, and sleep again along with what touched them
+    if(s.numSleeping > 0) {
+        for(long i=0; i<n; i++) {
+            if(s.flags[i] & kParticleFlagWake) s.wake(i);
+            else if(s.flags[i] & kParticleFlagTouched) s.wake(i, true);
+        }
+    }
+
+    // count the updates in a row each awake particle has been still for, and how many have been still long enough
+    // still means it has hardly moved since the end of the last update. pos - oldPos isn't used, as a particle resting on something
+    // still has the velocity gravity gave it this update (the collision moved it back, but didn't change oldPos)
+    float speed2 = _params->sleepSpeed * _params->sleepSpeed;
+    unsigned int frames = _params->sleepFrames;
+    std::atomic< long > numReady(0);
+    parallelFor(0, n, [&s, &numReady, speed2, frames](long begin, long end) {
+        long count = 0;
+        for(long i=begin; i<end; i++) {
+            float speed = 0;
+            for(int d=0; d<T::DIM; d++) {
+                float v = s.pos[d][i] - s.settledPos[d][i];
+                s.settledPos[d][i] = s.pos[d][i];
+                speed += v * v;
+            }
+            if(s.flags[i] & kParticleFlagsImmobile) continue;
+            unsigned int still = speed < speed2 ? std::min(s.stillFrames[i] + 1, frames) : 0;
+            s.stillFrames[i] = still;
+            count += still >= frames;
+        }
+        if(count) numReady += count;
+    });
+    if(numReady == 0) return;
+
+    // an island (particles joined by constraints, or touching) sleeps once all of it is ready, so a pile goes to sleep all at once
+    // fixed particles don't join islands, and particles in other worlds (which might move them) keep an island awake
+    // only ready particles are followed, anything else joined to them just stops the island sleeping
+    // touching particles are found with the query grid, which is only built when something is ready
+    const QueryGridT<T> *grid = isCollisionEnabled() ? &getQueryGrid() : nullptr;
+    float maxRadius = 0;
+    if(grid) {
+        for(long i=0; i<n; i++) if(s.flags[i] & kParticleFlagCollision) maxRadius = std::max(maxRadius, s.radius[i]);
+    }
+    float margin = _params->sleepSpeed;
+    auto isInContact = [&s, margin](long a, long b) {
+        if((s.flags[a] & s.flags[b] & kParticleFlagCollision) == 0 || (s.flags[a] & s.flags[b] & kParticleFlagPassiveCollision)) return false;
+        if((s.collisionPlane[a] & s.collisionPlane[b]) == 0) return false;
+        float contactLength = s.radius[a] + s.radius[b] + margin;
+        return (s.getPosition(b) - s.getPosition(a)).lengthSquared() <= contactLength * contactLength;
+    };
+
+    _islandVisited.assign(n, 0);
+    for(long i=0; i<n; i++) {
+        if(_islandVisited[i] || (s.flags[i] & kParticleFlagsImmobile) || s.stillFrames[i] < frames) continue;
+        _island.clear();
+        _island.push_back(i);
+        _islandVisited[i] = 1;
+        bool canSleep = !s.owner[i]->isDead();
+        for(size_t k=0; k<_island.size(); k++) {
+            ParticleT<T> *p = s.owner[_island[k]];
+            for(auto&& c : p->_constraints) {
+                ParticleT<T> *other = c->getParticleA() == p ? c->getParticleB() : c->getParticleA();
+                if(!other || other == p) continue;
+                if(other->_store != &s) {
+                    canSleep = false;
+                    continue;
+                }
+                long j = other->_slot;
+                if(_islandVisited[j] || (s.flags[j] & kParticleFlagFixed)) continue;
+                if(s.stillFrames[j] < frames || other->isDead()) {
+                    canSleep = false;
+                    continue;
                 }
+                _islandVisited[j] = 1;
+                _island.push_back(j);
             }
 
-            if(collided) {
-                p->moveTo(pos);
-                p->setOldPosition(oldPos);
-                p->collidedWithEdgeOfWorld(p->getVelocity() - vel);
+            long a = _island[k];
+            if(!grid || (s.flags[a] & kParticleFlagCollision) == 0) continue;
+            grid->findInRadius(s.getPosition(a), s.radius[a] + maxRadius + margin, _islandContacts);
+            for(long j : _islandContacts) {
+                if(_islandVisited[j] || (s.flags[j] & kParticleFlagsImmobile) || !isInContact(a, j)) continue;
+                if(s.stillFrames[j] < frames || s.owner[j]->isDead()) {
+                    canSleep = false;
+                    continue;
+                }
+                _islandVisited[j] = 1;
+                _island.push_back(j);
             }
         }
+        if(!canSleep) continue;
 
-        // find which sector particle is in
-        //					int i = mapRange(p->getX(), _params->worldMin.x, _params->worldMax.x, 0.0f, _params->sectorCount.x, true);
-        //					int j = mapRange(p->getY(), _params->worldMin.y, _params->worldMax.y, 0.0f, _params->sectorCount.y, true);
-        //					int k = mapRange(p->getZ(), _params->worldMin.z, _params->worldMax.z, 0.0f, _params->sectorCount.z, true);
-
-        if(isCollisionEnabled()) {
-            int sectorIndex = 0;
-            for(int i=0; i<T::DIM; i++) {
-                int t = _params->sectorCount[i] ? mapRange(p->getPosition()[i], _params->worldMin[i], _params->worldMax[i], 0.0f, _params->sectorCount[1]-1, true) : 0;
+        // stop dead, so they wake up with no velocity
+        for(long j : _island) {
+            if((s.flags[j] & kParticleFlagSleeping) == 0) s.numSleeping++;
+            s.flags[j] |= kParticleFlagSleeping;
+            s.setOldPosition(j, s.getPosition(j));
+        }
+    }
+}
 
-                // TODO:
-                //						for(int j=0; j<i; j++) {
-                //							t *= _params->sectorCount[i];
-                //						}
-                //						sectorIndex += t;
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::updateParticles() {
 
+    // age particles, and remove dead ones (including those which have just died of old age) first
+    ageParticles();
+    removeDeadParticles();
+
+    ParticleStoreT<T> &s = _particleStore;
+    long n = s.size();
+    const unsigned int *flags = s.flags.data();
+
+    // do verlet, one axis at a time over the packed arrays
+    parallelFor(0, n, [this, &s, flags](long begin, long end) {
+        for(int d=0; d<T::DIM; d++) {
+            float *pos = s.pos[d].data();
+            float *oldPos = s.oldPos[d].data();
+            const float *drag = s.drag.data();
+            const float g = _params->doGravity ? _params->gravity[d] : 0;
+            const float worldDrag = _params->drag;
+            for(long i=begin; i<end; i++) {
+                bool isFree = (flags[i] & kParticleFlagsImmobile) == 0;
+                float curPos = pos[i];
+                float vel = curPos - (oldPos[i] - g);
+                pos[i] = isFree ? curPos + vel * worldDrag * drag[i] : curPos;
+                oldPos[i] = isFree ? curPos : oldPos[i];
             }
-
-            _sectors[sectorIndex]->addParticle(p);
         }
+    });
+
+    // user code, so always called from this thread
+    for(long i=0; i<n; i++) s.owner[i]->update();
+    //        this->applyUpdaters(particle);    // TODO: bring back updaters
+
+    if(_params->doWorldEdges) {
+        _edgeForces.resize(n);
+        _hasHitEdge.assign(n, 0);
+        parallelFor(0, n, [this, &s](long begin, long end) {
+            for(long i=begin; i<end; i++) {
+                //				if(p->isFree())
+                if(s.flags[i] & kParticleFlagSleeping) continue;    // sleepers haven't moved since they were last in bounds
+                bool collided = false;
+                T vel(s.getPosition(i) - s.getOldPosition(i));
+                T pos(s.getPosition(i));
+                T oldPos(pos);
+                float radius = s.radius[i];
+                float bounce = s.bounce[i];
+                for(int d=0; d<T::DIM; d++) {
+                    float speed = vel[d];
+                    if(pos[d] < _params->worldMin[d] + radius) {
+                        pos[d] = _params->worldMin[d] + radius;
+                        oldPos[d] = pos[d] + speed * bounce;
+                        collided = true;
+                    } else if(pos[d] > _params->worldMax[d] - radius) {
+                        pos[d] = _params->worldMax[d] - radius;
+                        oldPos[d] = pos[d] + speed * bounce;
+                        collided = true;
+                    }
+                }
 
-        //					_sectors[i * _params->sectorCount.y * _params->sectorCount.x + j * _params->sectorCount.x + k]->addParticle(particle);
+                if(collided) {
+                    s.setPosition(i, pos);
+                    s.setOldPosition(i, oldPos);
+                    _edgeForces[i] = pos - oldPos - vel;
+                    _hasHitEdge[i] = 1;
+                }
+            }
+        });
 
-        //			printf("sector for particle at %f, %f, %f is %i %i %i\n", p->getX(), p->getY(), p->getZ(), i, j, k);
-        //			for(int s=0; s<_sectors.size(); s++) _sectors[s].checkParticle(particle);
+        // callbacks are user code too
+        for(long i=0; i<n; i++) if(_hasHitEdge[i]) s.owner[i]->collidedWithEdgeOfWorld(_edgeForces[i]);
+    }
 
 #ifdef MSAPHYSICS_USE_RECORDER
-        if(_replayMode == OFX_MSA_DATA_SAVE) _recorder.add(*particle);
+    if(_replayMode == OFX_MSA_DATA_SAVE) for(auto&& p : _particles) _recorder.add(*p);
 #endif
-    }
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::applyForces() {
+    if(_params->doGlobalAttraction) applyGlobalAttraction();
+    if(_params->doShortRangeForce) applyShortRangeForce();
+    applyAttractors();
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::applyGlobalAttraction() {
+    ParticleStoreT<T> &s = _particleStore;
+    long n = s.size();
+    _barnesHut.build(s);
+    _forces.resize(n);
+
+    float strength = _params->globalAttractionStrength;
+    float openingAngle = _params->openingAngle;
+    parallelFor(0, n, [this, &s, strength, openingAngle](long begin, long end) {
+        for(long i=begin; i<end; i++) _forces[i] = (s.flags[i] & kParticleFlagsImmobile) ? T() : _barnesHut.getAttraction(s, i, strength, openingAngle);
+    }, 64);
+
+    for(long i=0; i<n; i++) s.setPosition(i, s.getPosition(i) + _forces[i]);
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::applyShortRangeForce() {
+    updateSectors();
+    sortParticlesBySector();
+
+    ParticleStoreT<T> &s = _particleStore;
+    long n = s.size();
+    _forces.assign(n, T());
+
+    float strength = _params->shortRangeStrength;
+    float cutoff2 = _params->shortRangeCutoff * _params->shortRangeCutoff;
+    auto addForce = [this, &s, strength, cutoff2](long a, long b) {
+        T delta = s.getPosition(b) - s.getPosition(a);
+        float deltaLength2 = delta.lengthSquared();
+        if(deltaLength2 <= 0 || deltaLength2 >= cutoff2) return;
+        T force = delta * (strength / deltaLength2);
+        _forces[a] += force * s.mass[b];
+        _forces[b] -= force * s.mass[a];
+    };
+    forEachSectorPair([&addForce](const SectorT<T>& a, const SectorT<T>& b) {
+        if(&a == &b) a.forEachPair(addForce);
+        else a.forEachPairWith(b, addForce);
+    });
+
+    for(long i=0; i<n; i++) if((s.flags[i] & kParticleFlagsImmobile) == 0) s.setPosition(i, s.getPosition(i) + _forces[i]);
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::applyAttractors() {
+    _attractors.erase( remove_if(_attractors.begin(), _attractors.end(), [](const Attractor_ptr &a) { return a->isDead(); }), _attractors.end());
+    if(_attractors.empty()) return;
+
+    // one pass over the particles, each particle is moved by all attractors
+    // (unlike gravity and the global forces, which sleepers are at rest under, an attractor strong enough flags a sleeper to be woken)
+    ParticleStoreT<T> &s = _particleStore;
+    float wakeDistance2 = s.wakeDistance * s.wakeDistance;
+    parallelFor(0, s.size(), [this, &s, wakeDistance2](long begin, long end) {
+        for(long i=begin; i<end; i++) {
+            if(s.flags[i] & kParticleFlagFixed) continue;
+            T pos = s.getPosition(i);
+            T move;
+            for(auto&& a : _attractors) {
+                if(a->isOn() && (s.collisionPlane[i] & a->getParticleMask())) move += a->getMove(pos);
+            }
+            if((s.flags[i] & kParticleFlagSleeping) == 0) s.setPosition(i, pos + move);
+            else if(move.lengthSquared() > wakeDistance2) s.flags[i] |= kParticleFlagWake;
+        }
+    }, 256);
 }
 
 
@@ -533,29 +1463,243 @@ void WorldT<T>::updateParticles() {
 
 //--------------------------------------------------------------
 template <typename T>
-void WorldT<T>::updateConstraints() {
+typename WorldT<T>::Constraint_ptr WorldT<T>::addConstraint(Constraint_ptr c) {
+    if(!c || _constraintHandles.get(c->_handle, nullptr) == c.get()) return c;    // already in the world
+    c->_handle = _constraintHandles.add(c.get());
+    ConstraintListBaseT<T> *list = getConstraintListFor(*c);
+    list->add(c);
+
+    // index by particle, for findConstraint
+    // (joining two islands, the whole of both has to be awake)
+    ParticleT<T> *a = c->getParticleA();
+    ParticleT<T> *b = c->getParticleB();
+    if(a) { a->wake(); a->_constraints.push_back(c.get()); }
+    if(b && b != a) { b->wake(); b->_constraints.push_back(c.get()); }
+
+    // removed in the next update if it's dead already (or when it, or one of its ends, is killed)
+    c->_removalQueue = &_constraintRemovalQueue;
+    if(c->isDead()) c->queueRemoval();
+    else if(list == _springs) addSpringToBatch(static_cast< SpringT<T>* >(c.get()));
+    return c;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::removeConstraint(ConstraintT<T>& c) {
+    // take it out of the handle table and the particle index (the lists drop it themselves)
+    _constraintHandles.remove(c._handle);
+    c._removalQueue = nullptr;
+    ParticleT<T> *ends[2] = { c.getParticleA(), c.getParticleB() };
+    for(auto&& p : ends) {
+        if(!p) continue;
+        auto &v = p->_constraints;
+        auto it = find(v.begin(), v.end(), &c);
+        if(it == v.end()) continue;
+        *it = v.back();
+        v.pop_back();
+    }
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::removeDeadConstraints() {
+    // the queue can have a constraint more than once, or one which has gone already: its handle is stale then
+    for(auto&& h : _constraintRemovalQueue) {
+        ConstraintT<T> *c = _constraintHandles.get(h, nullptr);
+        if(!c) continue;
+        ConstraintListBaseT<T> *list = getConstraintListFor(*c);
+        if(list == _springs) removeSpringFromBatch(static_cast< SpringT<T>* >(c));
+        if(c->getParticleA()) c->getParticleA()->wake();     // whatever it was holding up falls
+        if(c->getParticleB()) c->getParticleB()->wake();
+        removeConstraint(*c);
+        list->remove(*c);   // (last, this might delete it)
+    }
+    _constraintRemovalQueue.clear();
+}
+
+//--------------------------------------------------------------
+template <typename T>
+ConstraintListBaseT<T>* WorldT<T>::getConstraintListFor(const ConstraintT<T>& c) {
+    for(size_t i=kConstraintTypeCount; i<_constraintLists.size(); i++) {
+        if(_constraintLists[i]->accepts(c)) return _constraintLists[i].get();
+    }
+    if(c.type() < kConstraintTypeCount && _constraintLists[c.type()]->accepts(c)) return _constraintLists[c.type()].get();
+    return _constraintLists[kConstraintTypeCustom].get();
+}
 
-    // remove constraints if dead
-    for(auto&& v : _constraints) {
-        v.second.erase( remove_if(v.second.begin(), v.second.end(), [](const Constraint_ptr &c) { return c->isDead(); }), v.second.end());
+//--------------------------------------------------------------
+template <typename T>
+template <typename C>
+typename WorldT<T>::World_ptr WorldT<T>::registerConstraintType() {
+    if(getConstraintList<C>()) return getThis();
+    auto list = make_shared< ConstraintListT<T, C> >(kConstraintTypeCustom, false);
+
+    // move constraints of this class out of the custom list
+    auto &custom = static_cast< ConstraintListT<T, ConstraintT<T> >& >(*_constraintLists[kConstraintTypeCustom]);
+    vector< Constraint_ptr > constraints;
+    constraints.swap(custom.getConstraints());
+    custom.clear();
+    for(auto&& c : constraints) {
+        if(list->accepts(*c)) list->add(c);
+        else custom.add(c);
     }
 
+    _constraintLists.push_back(list);
+    return getThis();
+}
+
+//--------------------------------------------------------------
+template <typename T>
+template <typename C>
+ConstraintListT<T, C>* WorldT<T>::getConstraintList() {
+    for(size_t i=kConstraintTypeCount; i<_constraintLists.size(); i++) {
+        auto list = dynamic_cast< ConstraintListT<T, C>* >(_constraintLists[i].get());
+        if(list) return list;
+    }
+    return nullptr;
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::updateConstraints() {
+
+    removeDeadConstraints();
+    wakeDisturbedSprings();
+    packSpringBatches();
+
     // iterations
+
     for (int n=0; n<_params->numIterations; n++) {
 
         // iterate constraint types
-        for(auto&& v : _constraints) {
+        for(size_t i=0; i<_constraintLists.size(); i++) {
+
+            // springs are solved through their batches
+            if(i == kConstraintTypeSpring) solveSpringBatches();
+            else _constraintLists[i]->solve();
+
+        }
+    }
+}
 
-            // iterate constraints
-            for(auto&& c : v.second) {
-                if(c->shouldSolve()) c->solve();
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::addSpringToBatch(SpringT<T> *s) {
+    // greedy colouring: the first batch neither end has a spring in yet
+    ParticleT<T> *a = s->getParticleA();
+    ParticleT<T> *b = s->getParticleB();
+    uint64_t used = a->_springBatchMask | b->_springBatchMask;
+    int i = 0;
+    while(i < kMaxSpringBatches && (used >> i) & 1) i++;
+    if(i < kMaxSpringBatches) {
+        a->_springBatchMask |= uint64_t(1) << i;
+        b->_springBatchMask |= uint64_t(1) << i;
+    }
+    if(i >= (int)_springBatches.size()) _springBatches.resize(i + 1);
+    s->_batch = i;
+    s->_batchIndex = _springBatches[i].size();
+    _springBatches[i].push_back(s);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::removeSpringFromBatch(SpringT<T> *s) {
+    int i = s->_batch;
+    if(i < 0) return;
+    auto &batch = _springBatches[i];
+    uint64_t bit = i < kMaxSpringBatches ? uint64_t(1) << i : 0;
+    if(s->getParticleA()) s->getParticleA()->_springBatchMask &= ~bit;
+    if(s->getParticleB()) s->getParticleB()->_springBatchMask &= ~bit;
+
+    // the last spring in the batch takes its place
+    SpringT<T> *last = batch.back();
+    batch[s->_batchIndex] = last;
+    last->_batchIndex = s->_batchIndex;
+    batch.pop_back();
+    s->_batch = -1;
+    s->_batchIndex = -1;
+    while(!_springBatches.empty() && _springBatches.back().empty()) _springBatches.pop_back();
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::clearSpringBatches() {
+    for(auto&& batch : _springBatches) {
+        for(auto&& s : batch) {
+            s->getParticleA()->_springBatchMask = 0;
+            s->getParticleB()->_springBatchMask = 0;
+            s->_batch = -1;
+            s->_batchIndex = -1;
+        }
+    }
+    _springBatches.clear();
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::wakeDisturbedSprings() {
+    // islands sleep as a whole, so a spring between a sleeper and a free particle means the island has just been disturbed
+    // wake them all before packing, so none of the island's springs are left out of this update
+    if(_particleStore.numSleeping == 0) return;
+    for(auto&& batch : _springBatches) {
+        for(auto&& s : batch) {
+            ParticleT<T> *a = s->getParticleA();
+            ParticleT<T> *b = s->getParticleB();
+            if(s->isOff() || a->isSleeping() == b->isSleeping()) continue;
+            ParticleT<T> *sleeper = a->isSleeping() ? a : b;
+            ParticleT<T> *other = a->isSleeping() ? b : a;
+            if(other->isFree()) sleeper->wake();
+        }
+    }
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::packSpringBatches() {
+    // particles change slots every frame, so this is redone every frame (it's cheap next to the iterations)
+    int numBatches = std::min((int)_springBatches.size(), (int)kMaxSpringBatches);
+    _packedSpringBatches.resize(numBatches);
+    _unpackedSprings.resize(numBatches);
+    for(int i=0; i<numBatches; i++) {
+        SpringBatchT<T> &packed = _packedSpringBatches[i];
+        packed.clear();
+        _unpackedSprings[i].clear();
+        for(auto&& s : _springBatches[i]) {
+            ParticleT<T> *a = s->getParticleA();
+            ParticleT<T> *b = s->getParticleB();
+            if(s->isOff() || ((a->isFixed() || a->isSleeping()) && (b->isFixed() || b->isSleeping()))) continue;
+
+            // the packed solver only knows about plain springs, between particles in this world
+            bool isPlain = typeid(*s) == typeid(SpringT<T>) && s->getMinDistance() == 0 && s->getMaxDistance() == 0;
+            if(!isPlain || a->_store != &_particleStore || b->_store != &_particleStore) {
+                _unpackedSprings[i].push_back(s);
+                continue;
             }
+            packed.add(a->_slot, b->_slot, s->getRestLength(), s->getStrength(), a->getInvMass(), b->getInvMass(), a->isFree(), b->isFree(), s->getForceCap());
+        }
+    }
+}
 
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::solveSpringBatches() {
+    for(size_t i=0; i<_springBatches.size(); i++) {
+        if(i == kMaxSpringBatches) {
+            for(auto&& s : _springBatches[i]) if(s->shouldSolve()) s->solve();
+            continue;
         }
+
+        const SpringBatchT<T> &packed = _packedSpringBatches[i];
+        parallelFor(0, packed.size(), [this, &packed](long begin, long end) { packed.solve(_particleStore, begin, end); });
+        for(auto&& s : _unpackedSprings[i]) if(s->shouldSolve()) s->solve();
     }
 }
 
 
+
+
 //--------------------------------------------------------------
 #ifdef MSAPHYSICS_USE_RECORDER
 template <typename T>
@@ -578,27 +1722,550 @@ World_ptr  WorldT<T>::setReplayFilename(string f) {
 //--------------------------------------------------------------
 template <typename T>
 void WorldT<T>::checkAllCollisions() {
-    for(auto&& s : _sectors) {
-        s->checkSectorCollisions();
-        s->clear();
+    if(_params->doNeighbourList) {
+        if(needsNeighbourListUpdate()) updateNeighbourList();
+        for(size_t k=0; k<_neighbourPairs.size(); k+=2) SectorT<T>::checkCollisionBetween(_particleStore, _neighbourPairs[k], _neighbourPairs[k+1]);
+        return;
+    }
+
+    // (hashed sectors have no grid to split into blocks)
+    if(_workerPool && _params->broadphase == kBroadphaseSectors && !isSectorHashEnabled()) {
+        checkCollisionsInPhases();
+        return;
+    }
+
+    ParticleStoreT<T> &s = _particleStore;
+    if(_params->broadphase == kBroadphaseSweepAndPrune) {
+        forEachCandidatePair([&s](long a, long b) { SectorT<T>::checkCollisionBetween(s, a, b); });
+        return;
+    }
+
+    // sectors are contiguous in the store, so the narrow phase can test several particles at once
+    updateSectors();
+    sortParticlesBySector();
+    forEachSectorPair([&s](const SectorT<T>& a, const SectorT<T>& b) {
+        if(a.isAsleep() && b.isAsleep()) return;
+        if(&a == &b) a.checkSectorCollisions(s);
+        else a.checkCollisionsWith(s, b);
+    });
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::checkCollisionsInPhases() {
+    updateSectors();
+    sortParticlesBySector();
+
+    ParticleStoreT<T> &s = _particleStore;
+    const int numCorners = 1 << T::DIM;
+    const int numBlockPairs = _sectorBlockPairs.size() / 2;
+    _collisionHits.clear();
+
+    for(int phase=0; phase<numCorners; phase++) {
+        const int *blocks = _sectorPhases.data() + _sectorPhaseStarts[phase];
+        long numBlocks = _sectorPhaseStarts[phase + 1] - _sectorPhaseStarts[phase];
+
+        parallelFor(0, numBlocks, [&, blocks](long begin, long end) {
+            vector< CollisionHit > hits;
+            auto check = [&s, &hits](long a, long b) {
+                T force;
+                if(SectorT<T>::resolveCollisionBetween(s, a, b, force)) hits.push_back({ a, b, force });
+            };
+
+            for(long k=begin; k<end; k++) {
+                int coords[kSectorKeySize];
+                getSectorCoords(blocks[k], coords);
+
+                // the (non empty) sector at each corner of the block, or -1
+                int corners[1 << T::DIM];
+                for(int c=0; c<numCorners; c++) {
+                    int cornerCoords[kSectorKeySize];
+                    for(int i=0; i<T::DIM; i++) cornerCoords[i] = coords[i] + ((c >> i) & 1);
+                    cornerCoords[T::DIM] = 0;
+                    int sectorIndex = findSector(cornerCoords);
+                    corners[c] = sectorIndex >= 0 && !_sectors[sectorIndex].empty() ? sectorIndex : -1;
+                }
+
+                for(int p=0; p<numBlockPairs; p++) {
+                    int a = corners[_sectorBlockPairs[p * 2]];
+                    int b = corners[_sectorBlockPairs[p * 2 + 1]];
+                    if(a < 0 || b < 0 || (_sectors[a].isAsleep() && _sectors[b].isAsleep())) continue;
+                    if(a == b) _sectors[a].forEachTouchingPair(s, check);
+                    else _sectors[a].forEachTouchingPairWith(s, _sectors[b], check);
+
+                }
+            }
+
+            if(hits.empty()) return;
+            lock_guard<mutex> lock(_collisionHitsMutex);
+            _collisionHits.insert(_collisionHits.end(), hits.begin(), hits.end());
+        }, 16);
+    }
+
+    // callbacks are user code, so call them from this thread, in an order which doesn't depend on the threads
+    sort(_collisionHits.begin(), _collisionHits.end(), [](const CollisionHit& x, const CollisionHit& y) { return x.a != y.a ? x.a < y.a : x.b < y.b; });
+    for(auto&& hit : _collisionHits) {
+        s.owner[hit.a]->collidedWithParticle(*s.owner[hit.b], hit.force);
+        s.owner[hit.b]->collidedWithParticle(*s.owner[hit.a], -hit.force);
+    }
+}
+
+
+
+//--------------------------------------------------------------
+// call f(a, b) with the slots of every pair of particles which might be touching
+// (done after the constraints so the broadphase matches where the particles actually are)
+template <typename T>
+template <typename F>
+void WorldT<T>::forEachCandidatePair(F f) {
+    if(_params->broadphase == kBroadphaseSweepAndPrune) {
+        updateSweep();
+
+        long n = _sweepOrder.size();
+        for(long k=0; k<n; k++) {
+            unsigned int a = _sweepOrder[k];
+            float maxA = _sweepMax[a];
+            if(_sweepMin[a] == FLT_MAX) break;      // the rest don't collide
+            for(long m=k+1; m<n && _sweepMin[_sweepOrder[m]] <= maxA; m++) f(a, _sweepOrder[m]);
+        }
+        return;
+    }
+
+    updateSectors();
+    sortParticlesBySector();
+    forEachSectorPair([&f](const SectorT<T>& a, const SectorT<T>& b) {
+        if(&a == &b) a.forEachPair(f);
+        else a.forEachPairWith(b, f);
+    });
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::updateSweep() {
+    ParticleStoreT<T> &s = _particleStore;
+    long n = s.size();
+
+    // sweep along the axis the particles are most spread out on
+    // only switch when another axis is clearly better, as the order then has to be sorted from scratch
+    float sum[T::DIM] = { 0 };
+    float sum2[T::DIM] = { 0 };
+    long count = 0;
+    for(long i=0; i<n; i++) {
+        if((s.flags[i] & kParticleFlagCollision) == 0) continue;
+        for(int d=0; d<T::DIM; d++) {
+            sum[d] += s.pos[d][i];
+            sum2[d] += s.pos[d][i] * s.pos[d][i];
+        }
+        count++;
+    }
+    if(count) {
+        float variance[T::DIM];
+        int bestAxis = 0;
+        for(int d=0; d<T::DIM; d++) {
+            float mean = sum[d] / count;
+            variance[d] = sum2[d] / count - mean * mean;
+            if(variance[d] > variance[bestAxis]) bestAxis = d;
+        }
+        if(variance[bestAxis] > variance[_sweepAxis] * 1.5f) {
+            _sweepAxis = bestAxis;
+            _isSweepDirty = true;
+        }
+    }
+
+    // interval of each particle on that axis. particles without collision sort to the end
+    // (candidates for the neighbour list are found at up to an extra skin apart)
+    float padding = _params->doNeighbourList ? _params->neighbourSkin * 0.5f : 0;
+    const float *pos = s.pos[_sweepAxis].data();
+    _sweepMin.resize(n);
+    _sweepMax.resize(n);
+    for(long i=0; i<n; i++) {
+        bool hasCollision = (s.flags[i] & kParticleFlagCollision) != 0;
+        float r = s.radius[i] + padding;
+        _sweepMin[i] = hasCollision ? pos[i] - r : FLT_MAX;
+        _sweepMax[i] = hasCollision ? pos[i] + r : FLT_MAX;
+    }
+
+    const float *keys = _sweepMin.data();
+    if(_isSweepDirty || (long)_sweepOrder.size() != n) {
+        _sweepOrder.resize(n);
+        for(long i=0; i<n; i++) _sweepOrder[i] = i;
+        sort(_sweepOrder.begin(), _sweepOrder.end(), [keys](unsigned int a, unsigned int b) { return keys[a] < keys[b]; });
+        _isSweepDirty = false;
+    } else {
+        // the order from last frame is nearly right, and insertion sort is close to O(N) for nearly sorted data
+        for(long k=1; k<n; k++) {
+            unsigned int v = _sweepOrder[k];
+            float key = keys[v];
+            long j = k - 1;
+            for(; j >= 0 && keys[_sweepOrder[j]] > key; j--) _sweepOrder[j + 1] = _sweepOrder[j];
+            _sweepOrder[j + 1] = v;
+        }
+    }
+}
+
+
+//--------------------------------------------------------------
+// call f(a, b) for each non empty sector with itself, and with each of its neighbours which come after it
+template <typename T>
+template <typename F>
+void WorldT<T>::forEachSectorPair(F f) const {
+    int numNeighbours = _sectorNeighbours.size() / T::DIM;
+    for(int s=0; s<(int)_sectors.size(); s++) {
+        const SectorT<T>& sector = _sectors[s];
+        if(sector.empty()) continue;
+        f(sector, sector);
+
+        int coords[kSectorKeySize];
+        getSectorCoords(s, coords);
+
+        int neighbourCoords[kSectorKeySize];
+        neighbourCoords[T::DIM] = coords[T::DIM];
+        for(int n=0; n<numNeighbours; n++) {
+            for(int i=0; i<T::DIM; i++) neighbourCoords[i] = coords[i] + _sectorNeighbours[n * T::DIM + i];
+            int neighbourIndex = findSector(neighbourCoords);
+            if(neighbourIndex >= 0 && !_sectors[neighbourIndex].empty()) f(sector, _sectors[neighbourIndex]);
+        }
+
+        // with levels, also check against the whole neighbourhood of the sectors containing this one on every coarser level
+        // (a particle always fits within a sector of its own level, so the largest collision distance is the coarser sector size)
+        int level = coords[T::DIM];
+        for(int coarseLevel = level + 1; coarseLevel < _numSectorLevels; coarseLevel++) {
+            if((_sectorLevelMask & (1 << coarseLevel)) == 0) continue;
+            int shift = coarseLevel - level;
+            int coarseCoords[T::DIM];
+            for(int i=0; i<T::DIM; i++) coarseCoords[i] = coords[i] >= 0 ? coords[i] >> shift : -((-coords[i] - 1) >> shift) - 1;
+
+            neighbourCoords[T::DIM] = coarseLevel;
+            int numOffsets = 1;
+            for(int i=0; i<T::DIM; i++) numOffsets *= 3;
+            for(int o=0; o<numOffsets; o++) {
+                for(int i=0, t=o; i<T::DIM; i++, t/=3) neighbourCoords[i] = coarseCoords[i] + t % 3 - 1;
+                int neighbourIndex = findSector(neighbourCoords);
+                if(neighbourIndex >= 0 && !_sectors[neighbourIndex].empty()) f(sector, _sectors[neighbourIndex]);
+            }
+        }
+    }
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+typename WorldT<T>::World_ptr WorldT<T>::enableNeighbourList(float skin) {
+    _params->doNeighbourList = true;
+    _params->neighbourSkin = std::max(skin, 0.0f);
+    _isNeighbourListDirty = true;
+    return getThis();
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+typename WorldT<T>::World_ptr WorldT<T>::enableGlobalAttraction(float strength, float openingAngle) {
+    _params->doGlobalAttraction = true;
+    _params->globalAttractionStrength = strength;
+    _params->openingAngle = std::max(openingAngle, 0.0f);
+    return getThis();
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+typename WorldT<T>::World_ptr WorldT<T>::enableShortRangeForce(float strength, float cutoff) {
+    _params->doShortRangeForce = true;
+    _params->shortRangeStrength = strength;
+    _params->shortRangeCutoff = std::max(cutoff, 0.0f);
+    _isNeighbourListDirty = true;
+    return getThis();
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+typename WorldT<T>::World_ptr WorldT<T>::enableSleeping(float speed, int frames) {
+    _params->doSleeping = true;
+    _params->sleepSpeed = std::max(speed, 0.0f);
+    _params->sleepFrames = std::max(frames, 1);
+    _particleStore.wakeDistance = _params->sleepSpeed;
+    return getThis();
+}
+
+//--------------------------------------------------------------
+template <typename T>
+typename WorldT<T>::World_ptr WorldT<T>::disableSleeping() {
+    _params->doSleeping = false;
+    ParticleStoreT<T> &s = _particleStore;
+    for(long i=0; i<s.size(); i++) {
+        s.flags[i] &= ~(kParticleFlagSleeping | kParticleFlagWake | kParticleFlagTouched);
+        s.stillFrames[i] = 0;
+    }
+    s.numSleeping = 0;
+    return getThis();
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+bool WorldT<T>::needsNeighbourListUpdate() const {
+
+    if(_isNeighbourListDirty || (long)_neighbourBuildRadius.size() != _particleStore.size()) return true;
+
+    // the list is safe until something has moved more than half the skin (two particles moving towards each other close the whole skin)
+    // or has grown, or has had collision switched on
+    float maxMove = _params->neighbourSkin * 0.5f;
+    float maxMove2 = maxMove * maxMove;
+    for(long i=0; i<_particleStore.size(); i++) {
+        float radius = (_particleStore.flags[i] & kParticleFlagCollision) ? _particleStore.radius[i] : -1;
+        if(radius > _neighbourBuildRadius[i]) return true;
+
+        float move2 = 0;
+        for(int d=0; d<T::DIM; d++) {
+            float m = _particleStore.pos[d][i] - _neighbourBuildPos[d][i];
+            move2 += m * m;
+        }
+        if(move2 > maxMove2) return true;
+    }
+    return false;
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::updateNeighbourList() {
+    ParticleStoreT<T> &s = _particleStore;
+    float skin = _params->neighbourSkin;
+    auto addIfClose = [this, &s, skin](long a, long b) {
+        float r = s.radius[a] + s.radius[b] + skin;
+        float dist2 = 0;
+        for(int d=0; d<T::DIM; d++) {
+            float delta = s.pos[d][b] - s.pos[d][a];
+            dist2 += delta * delta;
+        }
+        if(dist2 <= r * r) {
+            _neighbourPairs.push_back(a);
+            _neighbourPairs.push_back(b);
+        }
+    };
+
+    _neighbourPairs.clear();
+    forEachCandidatePair(addIfClose);
+
+    // remember where everything was
+    long n = s.size();
+    for(int d=0; d<T::DIM; d++) _neighbourBuildPos[d].assign(s.pos[d].begin(), s.pos[d].end());
+    _neighbourBuildRadius.resize(n);
+    for(long i=0; i<n; i++) _neighbourBuildRadius[i] = (s.flags[i] & kParticleFlagCollision) ? s.radius[i] : -1;
+    _isNeighbourListDirty = false;
+}
+
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::sortParticlesBySector() {
+    long n = _particleStore.size();
+    _particleSectors.resize(n);
+
+    // find which sector each particle is in (-1 if it doesn't collide, and there's no short range force)
+    if(isSectorHashEnabled()) {
+        // without world bounds, sectors are created on demand for each occupied cell, and found through a hash of their coordinates
+        size_t hashSize = 16;
+        while(hashSize < (size_t)n * 2) hashSize <<= 1;
+        _sectorHash.assign(hashSize, -1);
+        _sectorCoords.clear();
+        _sectorLevelMask = 0;
+
+        for(long i=0; i<n; i++) {
+            if(isInSectors(i)) {
+                int coords[kSectorKeySize];
+                getParticleSectorCoords(i, coords);
+                _particleSectors[i] = findOrAddHashedSector(coords);
+                _sectorLevelMask |= 1 << coords[T::DIM];
+            } else {
+                _particleSectors[i] = -1;
+            }
+        }
+        _sectors.resize(_sectorCoords.size() / kSectorKeySize);
+    } else {
+        for(long i=0; i<n; i++) _particleSectors[i] = isInSectors(i) ? getSectorIndex(i) : -1;
+
+    }
+
+    // counting sort: count particles per sector, prefix sum for the start of each sector, then scatter
+    // particles which aren't in a sector go in an extra bucket at the end
+
+    int numSectors = _sectors.size();
+    _sectorStarts.assign(numSectors + 2, 0);
+    for(long i=0; i<n; i++) {
+        if(_particleSectors[i] < 0) _particleSectors[i] = numSectors;
+        _sectorStarts[_particleSectors[i] + 2]++;
+    }
+    for(int s=2; s<numSectors+2; s++) _sectorStarts[s] += _sectorStarts[s - 1];
+
+    // (_sectorStarts is offset by one while scattering so it ends up holding the start of each sector)
+    _sortOrder.resize(n);
+    _sortedSlots.resize(n);
+    bool isSorted = true;
+    for(long i=0; i<n; i++) {
+        long k = _sectorStarts[_particleSectors[i] + 1]++;
+        _sortOrder[k] = i;
+        _sortedSlots[i] = k;
+        if(k != i) isSorted = false;
+    }
+
+    for(int s=0; s<numSectors; s++) _sectors[s].setRange(_sectorStarts[s], _sectorStarts[s + 1]);
+
+    // sectors with only sleepers in don't need checking against each other (slot k is about to be particle _sortOrder[k])
+    const unsigned int *flags = _particleStore.flags.data();
+    for(int s=0; s<numSectors; s++) {
+        bool isAsleep = _particleStore.numSleeping > 0;
+        for(long k=_sectorStarts[s]; isAsleep && k<_sectorStarts[s + 1]; k++) isAsleep = (flags[_sortOrder[k]] & kParticleFlagSleeping) != 0;
+        _sectors[s].setAsleep(isAsleep);
+    }
+
+    // move the particle data so each sector is contiguous in memory
+    // the sort is stable, so if no particle changed sector there is nothing to move
+    if(isSorted) return;
+    _particleStore.reorder(_sortOrder);
+    _sortedParticles.resize(n);
+    for(long i=0; i<n; i++) _sortedParticles[i] = std::move(_particles[_sortOrder[i]]);
+    _particles.swap(_sortedParticles);
+
+    // the neighbour list and the sweep order hold slots, so move them along with the particles
+    // (the short range force sorts by sector even when collisions use one of those). a dirty neighbour list is about to be rebuilt anyway,
+    // and might hold slots which have gone
+    if(!_isNeighbourListDirty && (long)_neighbourBuildRadius.size() == n) {
+        for(auto&& slot : _neighbourPairs) slot = _sortedSlots[slot];
+        for(int d=0; d<T::DIM; d++) {
+            _sortScratch.resize(n);
+            for(long i=0; i<n; i++) _sortScratch[i] = _neighbourBuildPos[d][_sortOrder[i]];
+            _neighbourBuildPos[d].swap(_sortScratch);
+        }
+        _sortScratch.resize(n);
+        for(long i=0; i<n; i++) _sortScratch[i] = _neighbourBuildRadius[_sortOrder[i]];
+        _neighbourBuildRadius.swap(_sortScratch);
+    }
+    if((long)_sweepOrder.size() == n) {
+        for(auto&& slot : _sweepOrder) slot = _sortedSlots[slot];
     }
 }
 
 
+
 //--------------------------------------------------------------
 template <typename T>
 vector<typename WorldT<T>::Particle_ptr> WorldT<T>::findParticles(const T& pos, float radius) {
+    vector<long> found;
+    findParticles(pos, radius, found);
     vector<Particle_ptr> ret;
-    for(auto&& p : _particles) if((p->getPosition() - pos).lengthSquared() < radius * radius) ret.push_back(p);
+    ret.reserve(found.size());
+    for(auto&& i : found) ret.push_back(_particles[i]);
     return ret;
 }
 
+//--------------------------------------------------------------
+template <typename T>
+const QueryGridT<T>& WorldT<T>::getQueryGrid() {
+    if(_isQueryGridDirty) {
+        _queryGrid.build(_particleStore, _params->queryCellSize);
+        _isQueryGridDirty = false;
+    }
+    return _queryGrid;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::findParticles(const T& pos, float radius, vector<long>& out) {
+    getQueryGrid().findInRadius(pos, radius, out);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::findNearestParticles(const T& pos, int k, vector<long>& out) {
+    getQueryGrid().findNearest(pos, k, out, _queryHeap);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::findParticlesInBox(const T& boxMin, const T& boxMax, vector<long>& out) {
+    getQueryGrid().findInBox(boxMin, boxMax, out);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+bool WorldT<T>::castRay(const T& origin, const T& direction, RayHit& hit, float maxDistance) {
+    float length = direction.length();
+    if(length <= 0) return false;
+    getQueryGrid().castRay(origin, direction / length, maxDistance, true, _rayHits);
+    if(_rayHits.empty()) return false;
+    hit = _rayHits[0];
+    return true;
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::castRayAll(const T& origin, const T& direction, vector< RayHit >& hits, float maxDistance) {
+    float length = direction.length();
+    if(length <= 0) hits.clear();
+    else getQueryGrid().castRay(origin, direction / length, maxDistance, false, hits);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+bool WorldT<T>::castSegment(const T& a, const T& b, RayHit& hit) {
+    return castRay(a, b - a, hit, (b - a).length());
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::castSegmentAll(const T& a, const T& b, vector< RayHit >& hits) {
+    castRayAll(a, b - a, hits, (b - a).length());
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::findParticles(const vector<T>& positions, float radius, vector< vector<long> >& out) {
+    const QueryGridT<T> &grid = getQueryGrid();
+    out.resize(positions.size());
+    parallelFor(0, positions.size(), [&](long begin, long end) {
+        for(long i=begin; i<end; i++) grid.findInRadius(positions[i], radius, out[i]);
+    }, 16);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::findNearestParticles(const vector<T>& positions, int k, vector< vector<long> >& out) {
+    const QueryGridT<T> &grid = getQueryGrid();
+    out.resize(positions.size());
+    parallelFor(0, positions.size(), [&](long begin, long end) {
+        typename QueryGridT<T>::Heap heap;
+        for(long i=begin; i<end; i++) grid.findNearest(positions[i], k, out[i], heap);
+    }, 16);
+}
+
+//--------------------------------------------------------------
+template <typename T>
+void WorldT<T>::findParticlesInBox(const vector<T>& boxMins, const vector<T>& boxMaxs, vector< vector<long> >& out) {
+    const QueryGridT<T> &grid = getQueryGrid();
+    long n = std::min(boxMins.size(), boxMaxs.size());
+    out.resize(n);
+    parallelFor(0, n, [&](long begin, long end) {
+        for(long i=begin; i<end; i++) grid.findInBox(boxMins[i], boxMaxs[i], out[i]);
+    }, 16);
+}
+
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::Constraint_ptr WorldT<T>::findConstraint(Particle_ptr a, Particle_ptr b, int constraintType) {
-    for(auto&& constraint : _constraints[constraintType]) {
-        if(((constraint->getA() == a && constraint->getB() == b) || (constraint->getA() == b && constraint->getB() == a)) && !constraint->isDead()) {
-            return constraint;
+    if(!a || !b) return nullptr;
+
+    // look through whichever end has fewer constraints
+    ParticleT<T> *p = a->_constraints.size() <= b->_constraints.size() ? a.get() : b.get();
+    ParticleT<T> *other = p == a.get() ? b.get() : a.get();
+    for(auto&& constraint : p->_constraints) {
+        ParticleT<T> *otherEnd = constraint->getParticleA() == p ? constraint->getParticleB() : constraint->getParticleA();
+        if(constraint->type() == constraintType && otherEnd == other && isInWorld(*constraint) && !constraint->isDead()) {
+            return constraint->shared_from_this();
         }
     }
     return nullptr;
@@ -608,9 +2275,10 @@ typename WorldT<T>::Constraint_ptr WorldT<T>::findConstraint(Particle_ptr a, Par
 //--------------------------------------------------------------
 template <typename T>
 typename WorldT<T>::Constraint_ptr WorldT<T>::findConstraint(Particle_ptr a, int constraintType) {
-    for(auto&& constraint : _constraints[constraintType]) {
-        if (((constraint->getA() == a ) || (constraint->getB() == a)) && !constraint->isDead()) {
-            return constraint;
+    if(!a) return nullptr;
+    for(auto&& constraint : a->_constraints) {
+        if(constraint->type() == constraintType && isInWorld(*constraint) && !constraint->isDead()) {
+            return constraint->shared_from_this();
         }
     }
     return nullptr;
@@ -0,0 +1,49 @@
+// checks that collisions through the neighbour list still work with the short range force on
+// the short range force sorts particles by sector every update, which moves them to new slots under the neighbour list
+// build with ofxMSACore/src and ofxMSAPhysics/src on the include path, e.g.
+// g++ -std=c++14 -O2 -pthread -I../../ofxMSACore/src -I../src neighbourListShortRange.cpp -o neighbourListShortRange
+
+#include "MSAPhysics2D.h"
+#include <cstdio>
+
+using namespace msa;
+using namespace msa::physics;
+
+int main() {
+    auto world = World2D::create();
+    world->setGravity(Vec2f(0, 0));
+    world->setTimeStep(1);
+    world->setDrag(1);
+    world->setWorldSize(Vec2f(0, 0), Vec2f(96, 96));       // with radius 2 and skin 20, sectors are 24 across
+    world->enableCollision();
+    world->enableShortRangeForce(0, 1);                     // no force, but particles are still sorted by sector every update
+    world->enableNeighbourList(20);
+
+    // a cluster of particles in the sector from (48, 48) to (72, 72), each in a collision plane of its own so they don't push each other around
+    for(int i=0; i<16; i++) world->makeParticle(Vec2f(50 + (i % 4) * 2, 50 + (i / 4) * 2))->setRadius(2)->setCollisionPlane(1 << (i + 1));
+
+    // two particles heading for each other in the same sector
+    auto a = world->makeParticle(Vec2f(53, 62))->setRadius(2)->setCollisionPlane(1)->setVelocity(Vec2f(0.2f, 0));
+
+    // one in another plane again, about to move into the sector before, which moves everything added before it up a slot
+    // (but none of them far from where the particle which had their slot was, so the neighbour list isn't rebuilt)
+    world->makeParticle(Vec2f(49, 56))->setRadius(2)->setCollisionPlane(1 << 17)->setVelocity(Vec2f(-0.5f, 0));
+
+    auto b = world->makeParticle(Vec2f(59, 62))->setRadius(2)->setCollisionPlane(1)->setVelocity(Vec2f(-0.2f, 0));
+
+    float deepest = 0;
+    for(int frame=0; frame<20; frame++) {
+        world->update();
+        float overlap = a->getRadius() + b->getRadius() - (b->getPosition() - a->getPosition()).length();
+        deepest = std::max(deepest, overlap);
+    }
+
+    // they meet after 5 updates, and are pushed apart by the collision after that
+    if(deepest > 0.5f) {
+        printf("FAILED: the two particles overlapped by %f\n", deepest);
+        return 1;
+    }
+
+    printf("OK: the two particles overlapped by at most %f\n", deepest);
+    return 0;
+}
@@ -0,0 +1,107 @@
+// checks that the sectors' search for touching pairs, which tests several particles at once with SIMD, finds the same pairs as isTouching
+// for random mixes of passive, sleeping and non-colliding particles and collision planes, in sectors of all sizes up to a few SIMD groups
+// and with the pairs' callback moving particles, as resolving collisions does
+// build with ofxMSACore/src and ofxMSAPhysics/src on the include path, with and without AVX2, e.g.
+// g++ -std=c++14 -O2 -pthread -I../../ofxMSACore/src -I../src sectorTouching.cpp -o sectorTouching
+// g++ -std=c++14 -O2 -pthread -mavx2 -I../../ofxMSACore/src -I../src sectorTouching.cpp -o sectorTouchingAvx
+
+#include "MSAPhysics2D.h"
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+using namespace msa;
+using namespace msa::physics;
+
+typedef ParticleStoreT<Vec2f>   Store;
+typedef SectorT<Vec2f>          Sector;
+typedef vector< pair<long, long> >  Pairs;
+
+static unsigned int seed = 1;
+static int random(int n) { seed = seed * 1664525 + 1013904223; return (seed >> 8) % n; }
+
+// positions and radii are multiples of a quarter, so distances are exact with or without SIMD, and some pairs are exactly touching
+static float randomQuarters(int n) { return random(n) * 0.25f; }
+
+static void fill(Store& store, long n) {
+    const unsigned int planes[] = { 0, 1, 2, 3, 0xffffffff };
+    store.clear();
+    for(long i=0; i<n; i++) {
+        ParticleStateT<Vec2f> s = ParticleStateT<Vec2f>();
+        s.pos = s.oldPos = Vec2f(randomQuarters(64), randomQuarters(64));
+        s.radius = randomQuarters(16);
+        s.flags = 0;
+        if(random(8)) s.flags |= kParticleFlagCollision;
+        if(random(4) == 0) s.flags |= kParticleFlagPassiveCollision;
+        if(random(4) == 0) s.flags |= kParticleFlagSleeping;
+        s.collisionPlane = planes[random(5)];
+        store.add(nullptr, s);
+    }
+}
+
+// where the callback moves the first particle of each pair to, so the pairs after it depend on it having been tested from where it went
+static void push(Store& store, long a, long b) {
+    store.pos[0][a] += (store.pos[0][a] < store.pos[0][b]) ? -1.0f : 1.0f;
+    store.pos[1][a] += 0.25f;
+}
+
+// what the sectors should do: test pairs one at a time, in order, calling back for each touching one
+static Pairs expectedPairs(Store& store, long begin, long end, long otherBegin, long otherEnd, bool isWithOther, bool doPush) {
+    Pairs pairs;
+    for(long a=begin; a<end; a++) {
+        for(long b = isWithOther ? otherBegin : a + 1; b < (isWithOther ? otherEnd : end); b++) {
+            if(!Sector::isTouching(store, a, b)) continue;
+            pairs.push_back(make_pair(a, b));
+            if(doPush) push(store, a, b);
+        }
+    }
+    return pairs;
+}
+
+static bool check(const Pairs& pairs, const Pairs& expected, const Store& store, const Store& expectedStore, const char *name, int trial) {
+    bool isSame = pairs == expected;
+    for(long i=0; i<store.size(); i++) {
+        for(int d=0; d<2; d++) isSame = isSame && store.pos[d][i] == expectedStore.pos[d][i];
+    }
+    if(!isSame) printf("FAILED: %s, trial %d found %d pairs, expected %d\n", name, trial, (int)pairs.size(), (int)expected.size());
+    return isSame;
+}
+
+int main() {
+    Store store, expectedStore;
+    long numPairs = 0;
+
+    for(int trial=0; trial<20000; trial++) {
+        // two neighbouring sectors, each between empty and a few SIMD groups long, and some particles either side which shouldn't be touched
+        long begin = random(4);
+        long length = random(28);
+        long otherLength = random(28);
+        Sector sector, other;
+        sector.setRange(begin, begin + length);
+        other.setRange(begin + length, begin + length + otherLength);
+        long n = other.end() + random(4);
+        bool doPush = random(2);
+
+        fill(store, n);
+        expectedStore = store;
+        Pairs pairs;
+        auto f = [&](long a, long b) {
+            pairs.push_back(make_pair(a, b));
+            if(doPush) push(store, a, b);
+        };
+
+        sector.forEachTouchingPair(store, f);
+        Pairs expected = expectedPairs(expectedStore, sector.begin(), sector.end(), 0, 0, false, doPush);
+        if(!check(pairs, expected, store, expectedStore, "forEachTouchingPair", trial)) return 1;
+        numPairs += pairs.size();
+
+        pairs.clear();
+        sector.forEachTouchingPairWith(store, other, f);
+        expected = expectedPairs(expectedStore, sector.begin(), sector.end(), other.begin(), other.end(), true, doPush);
+        if(!check(pairs, expected, store, expectedStore, "forEachTouchingPairWith", trial)) return 1;
+        numPairs += pairs.size();
+    }
+
+    printf("OK: %ld touching pairs found\n", numPairs);
+    return 0;
+}
@@ -0,0 +1,90 @@
+// checks that a pile of particles resting on the floor of the world falls asleep with the default sleeping threshold, and stays asleep
+// and that changing one of them, or dropping another on top, wakes them, after which they fall asleep again
+// build with ofxMSACore/src and ofxMSAPhysics/src on the include path, e.g.
+// g++ -std=c++14 -O2 -pthread -I../../ofxMSACore/src -I../src sleepingPile.cpp -o sleepingPile
+
+#include "MSAPhysics2D.h"
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+using namespace msa;
+using namespace msa::physics;
+
+int main() {
+    int numParticles = 90;
+
+    auto world = World2D::create();
+    world->setGravity(Vec2f(0, 0.5f));
+    world->setTimeStep(1);
+    world->setDrag(0.5f);
+    world->setWorldSize(Vec2f(0, 0), Vec2f(400, 400));
+    world->enableCollision();
+    world->enableSleeping();
+
+    // drop them from above, so they land on each other and settle a few layers deep
+    unsigned int seed = 1;
+    auto random = [&seed]() { seed = seed * 1664525 + 1013904223; return (seed >> 8) / 16777216.0f; };
+    std::vector< Particle2D_ptr > particles;
+    for(int i=0; i<numParticles; i++) particles.push_back(world->makeParticle(Vec2f(10 + random() * 380, 200 + random() * 180))->setRadius(5));
+
+    // returns how many updates it took for everything to fall asleep, or -1 if it didn't
+    auto settle = [&]() {
+        int frame = 0;
+        while(frame < 2000 && world->numberOfSleepingParticles() < numParticles) {
+            world->update();
+            frame++;
+        }
+        if(world->numberOfSleepingParticles() < numParticles) {
+            printf("FAILED: %ld of %d particles asleep after %d updates\n", world->numberOfSleepingParticles(), numParticles, frame);
+            return -1;
+        }
+        return frame;
+    };
+
+    int frame = settle();
+    if(frame < 0) return 1;
+
+    // nothing is touching the pile, so it shouldn't wake itself up
+    for(int i=0; i<100; i++) world->update();
+    if(world->numberOfSleepingParticles() < numParticles) {
+        printf("FAILED: the pile woke up again, %ld of %d particles asleep\n", world->numberOfSleepingParticles(), numParticles);
+        return 1;
+    }
+
+    // changing any of these on a sleeper wakes it
+    struct Change { const char *name; std::function< void(Particle2D_ptr) > apply; };
+    Change changes[] = {
+        { "setRadius", [](Particle2D_ptr p) { p->setRadius(5); } },
+        { "setMass", [](Particle2D_ptr p) { p->setMass(1); } },
+        { "setCollisionPlane", [](Particle2D_ptr p) { p->setCollisionPlane(-1); } },
+        { "addVelocity", [](Particle2D_ptr p) { p->addVelocity(Vec2f(0, 0)); } },
+        { "moveBy", [](Particle2D_ptr p) { p->moveBy(Vec2f(0, 0)); } },
+    };
+    for(auto&& change : changes) {
+        auto p = particles[numParticles / 2];
+        change.apply(p);
+        if(p->isSleeping()) {
+            printf("FAILED: %s didn't wake a sleeping particle\n", change.name);
+            return 1;
+        }
+        if(settle() < 0) return 1;
+    }
+
+    // dropping another particle on the pile wakes what it lands on (with this much drag, it takes a while to fall)
+    world->makeParticle(Vec2f(200, 10))->setRadius(5);
+    numParticles++;
+    long fewestAsleep = numParticles;
+    for(int i=0; i<1000; i++) {
+        world->update();
+        fewestAsleep = std::min(fewestAsleep, world->numberOfSleepingParticles());
+    }
+    if(fewestAsleep >= numParticles - 1) {
+        printf("FAILED: dropping a particle on the pile didn't wake any of it\n");
+        return 1;
+    }
+    if(settle() < 0) return 1;
+
+    printf("OK: the pile fell asleep after %d updates\n", frame);
+    return 0;
+}